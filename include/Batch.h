@@ -0,0 +1,30 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "Driver.h"
+#include "PietRuntime.h"
+
+// Collect the inputs of a batch: every regular file in a directory (sorted by name), except the
+// outputs of earlier batches written next to their inputs (.ll, .o and .out files, and graph or
+// codel files sharing the stem of another file), or every non-empty line of a list file.
+// Returns false if the source cannot be read.
+bool collectBatchInputs(const std::string &source, std::vector<std::string> &inputs);
+
+// Compile every input on a pool of `jobs` worker threads, each owning its own LLVMContext.
+// Each input is written to <outDir>/<stem>.ll (or .o), or next to the input if outDir is empty.
+// Prints a failure summary and returns the number of inputs that failed.
+int runBatch(const std::vector<std::string> &inputs, const std::string &outDir, int jobs,
+             const CompileOptions &options);
+
+// Run a program (its piet_run) once per input stream on a pool of `jobs` worker threads, each
+// reusing its own piet_ctx. The input file is the program's input; its output is written to
+// <outDir>/<stem>.out, or next to the input if outDir is empty; a run that runs out of fuel
+// fails, but its output is still written. Prints a failure summary and returns the number of
+// inputs that failed.
+int runInputs(const std::function<int(piet_ctx*)> &run, const std::vector<std::string> &inputs,
+              const std::string &outDir, int jobs);
+
+#endif // BATCH_H
@@ -0,0 +1,28 @@
+#ifndef COMPILE_CACHE_H
+#define COMPILE_CACHE_H
+
+#include <string>
+#include <vector>
+#include "PietTypes.h"
+
+// A content-addressed, on-disk cache of compiled artifacts.
+// Entries are keyed by the normalized codel grid (not the input file bytes) together with
+// the compiler options, so re-encoded images of the same program share a single entry.
+class CompileCache {
+public:
+    explicit CompileCache(const std::string &directory);
+    // Compute the key of a codel grid compiled with the given option fingerprint.
+    static std::string computeKey(const std::vector<std::vector<PietColor>> &grid,
+                                  const std::string &options);
+    // Copy the cached artifact (e.g. "ll") for key to outputPath. Returns true on a hit.
+    bool lookup(const std::string &key, const std::string &artifact,
+                const std::string &outputPath) const;
+    // Store the file at path as the artifact for key. Returns true on success.
+    bool store(const std::string &key, const std::string &artifact,
+               const std::string &path) const;
+private:
+    std::string directory;
+    std::string entryPath(const std::string &key, const std::string &artifact) const;
+};
+
+#endif // COMPILE_CACHE_H
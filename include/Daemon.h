@@ -0,0 +1,40 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+class ProgramCache;
+
+// A Pietric command line and the environment it runs in: the process's own, or that of a
+// daemon client.
+struct CommandLine {
+    std::vector<std::string> args;          // The arguments, without the program name.
+    std::string cacheDir;                   // The issuer's PIETRIC_CACHE_DIR (empty if unset).
+    FILE *in = stdin;                       // The streams of programs run by --run.
+    FILE *out = stdout;
+    ProgramCache *programCache = nullptr;   // Shared by all commands of a daemon.
+    bool inDaemon = false;
+};
+
+typedef std::function<int(const CommandLine&)> CommandHandler;
+
+// Serve command lines sent by pietric-client (see DaemonProtocol.h) on a Unix domain socket,
+// with `jobs` worker threads (0: one per core). The process keeps LLVM initialized and one
+// ProgramCache for all commands. Each command runs in the client's working directory, with
+// a console of its own (consoleOut() and consoleErr(), see Diagnostics.h) going to the
+// client's stdout and stderr; the client exits with handler's result. An exception thrown by handler fails only its command. Returns
+// only if the socket cannot be set up or accepting fails (with 1); otherwise it serves until
+// killed.
+int runDaemon(const std::string &socketPath, int jobs, const CommandHandler &handler);
+
+// Run body (a run of an already compiled program) in a child process of the daemon, and return
+// its status. The client's streams (command.in, command.out and the console) stay
+// connected in the child. A crash or abort of the run ends only the child: the client is told
+// which signal stopped it, and gets 128 + the signal number. If the client hangs up first, the
+// child is killed, so an abandoned run does not keep a worker busy.
+int runInChild(const CommandLine &command, const std::function<int()> &body);
+
+#endif // DAEMON_H
@@ -0,0 +1,44 @@
+#ifndef DAEMON_PROTOCOL_H
+#define DAEMON_PROTOCOL_H
+
+#include <string>
+#include <vector>
+
+// The protocol between pietric-client and the daemon (--daemon), over a Unix domain stream
+// socket. A client connects, sends one request, and passes its stdin, stdout and stderr along
+// with it (SCM_RIGHTS); the daemon runs the command on those descriptors and replies with the
+// command's exit status, then closes the connection.
+//
+// A request is a 32-bit length followed by that many bytes of strings, each a 32-bit length and
+// its bytes: the working directory, the value of PIETRIC_CACHE_DIR, then the arguments. The
+// status is a 32-bit integer. Integers are in host byte order (both ends are on one host).
+
+// A command line, with the environment it was issued in.
+struct DaemonRequest {
+    std::string cwd;                // The client's working directory.
+    std::string cacheDir;           // The client's PIETRIC_CACHE_DIR (empty if unset).
+    std::vector<std::string> args;  // The arguments, without the program name.
+};
+
+// The socket of the daemon: $PIETRIC_DAEMON_SOCKET, or $XDG_RUNTIME_DIR/pietric.sock, or
+// /tmp/pietric-<uid>/daemon.sock. The daemon creates a missing directory for it, private to the
+// user.
+std::string daemonSocketPath();
+
+// Whether the process at the other end of a connected socket runs as the same user. Both ends
+// check it: the client's descriptors, and the daemon's access to the user's files, must not be
+// handed to another user.
+bool peerIsCurrentUser(int socket);
+
+// Send a request with the descriptors fds[0..2] (stdin, stdout, stderr). Returns false on error,
+// with errno set.
+bool sendDaemonRequest(int socket, const DaemonRequest &request, const int fds[3]);
+
+// Receive a request and its three descriptors (owned by the caller on success). Returns false if
+// the connection ends first or the request is malformed.
+bool receiveDaemonRequest(int socket, DaemonRequest &request, int fds[3]);
+
+bool sendDaemonStatus(int socket, int status);
+bool receiveDaemonStatus(int socket, int &status);
+
+#endif // DAEMON_PROTOCOL_H
@@ -0,0 +1,53 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <functional>
+#include <iosfwd>
+#include <string>
+
+// Severity of a diagnostic reported by the compiler.
+enum class DiagnosticSeverity {
+    Note,       // Progress information (e.g. the detected codel size).
+    Warning,    // Something went wrong, but the compilation continues.
+    Error       // The operation that reported it fails.
+};
+
+// Receives the diagnostics of the compiler instead of the console.
+using DiagnosticHandler = std::function<void(DiagnosticSeverity severity, const std::string &message)>;
+
+// Routes the diagnostics reported on the current thread to a handler for as long as it lives
+// (scopes nest). Without one, errors and warnings go to consoleErr() and notes to consoleOut().
+class DiagnosticScope {
+public:
+    explicit DiagnosticScope(DiagnosticHandler handler);
+    ~DiagnosticScope();
+    DiagnosticScope(const DiagnosticScope &) = delete;
+    DiagnosticScope &operator=(const DiagnosticScope &) = delete;
+private:
+    DiagnosticHandler previous;
+};
+
+void reportError(const std::string &message);
+void reportWarning(const std::string &message);
+void reportNote(const std::string &message);
+
+// The console of the current thread, where console diagnostics and the command-line front end
+// write: std::cout and std::cerr, unless a ConsoleScope redirected it.
+std::ostream &consoleOut();
+std::ostream &consoleErr();
+
+// Redirects the console of the current thread to other streams for as long as it lives (scopes
+// nest). The daemon gives each request streams of its own this way, so that requests never
+// share stream state.
+class ConsoleScope {
+public:
+    ConsoleScope(std::ostream &out, std::ostream &err);
+    ~ConsoleScope();
+    ConsoleScope(const ConsoleScope &) = delete;
+    ConsoleScope &operator=(const ConsoleScope &) = delete;
+private:
+    std::ostream *previousOut;
+    std::ostream *previousErr;
+};
+
+#endif // DIAGNOSTICS_H
@@ -0,0 +1,80 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Diagnostics.h"
+#include "PietTypes.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+class Graph;
+class ProgramCache;
+
+// The kind of artifact a compilation produces.
+enum class EmitKind {
+    LLVMIR,     // Textual LLVM IR (.ll)
+    Object,     // Native object code (.o)
+    Graph,      // The execution graph in the binary graph file format (.pgraph)
+    Codels      // The parsed codel grid in the packed codel file format (.pcodels)
+};
+
+// Options that control a single compilation.
+struct CompileOptions {
+    std::string cacheDir;       // Directory of the compile cache (empty disables caching).
+    EmitKind emit = EmitKind::LLVMIR;
+    int partitionThreshold = 4096; // See IRGenerator::setPartitionThreshold.
+    int codegenThreads = 1;     // Objects are split into this many parts, generated in parallel.
+    bool minimize = true;       // Merge equivalent graph states before code generation.
+    bool trace = false;         // Record executed nodes with the trace runtime (implies no
+                                // minimization, so traces map back to the source program).
+    bool guardedStack = false;  // Run unbounded-depth programs on a guarded stack (unchecked pushes).
+    uint64_t evalSteps = 1000000; // Steps of the input-free prefix run at compile time (0: none;
+                                  // not with trace, which must record every step, nor with fuel).
+    uint64_t fuel = 0;          // Loop iterations a run may take (0: unlimited; see
+                                // IRGenerator::setFuel).
+    DiagnosticHandler diagnostics; // Receives the diagnostics of a compilation (default: console).
+    ProgramCache *programCache = nullptr; // Parsed grids and built graphs shared with other
+                                          // compilations (null: none; see ProgramCache.h).
+
+    // Returns a string identifying every option that affects the generated code.
+    // It is part of the compile cache key.
+    std::string fingerprint() const;
+};
+
+// The file extension of the artifacts of an emit kind ("ll", "o", "pgraph" or "pcodels").
+const char *outputExtension(EmitKind emit);
+
+// The files written for outputFile: the file itself, or, when an object is generated by several
+// codegen threads, one numbered object per thread ("output.o" becomes "output.0.o", ...).
+std::vector<std::string> outputPaths(const std::string &outputFile, const CompileOptions &options);
+
+// Compile one Piet program (text, image or codel file), or a graph file, into LLVM IR,
+// object file(s), a graph file or a codel file.
+// Returns true on success.
+bool compileFile(const std::string &inputFile, const std::string &outputFile,
+                 const CompileOptions &options, llvm::LLVMContext &context);
+
+// Compile a codel grid entirely in memory: nothing is read from or written to the filesystem,
+// and the compile cache is not used. On success outputs holds the artifact contents, one per
+// entry of outputPaths() (several objects only with more than one codegen thread).
+bool compileGrid(const std::vector<std::vector<PietColor>> &grid, const CompileOptions &options,
+                 llvm::LLVMContext &context, std::vector<std::string> &outputs);
+
+// Like compileGrid, for a program held in memory: a PNG, BMP or GIF image, a packed codel file
+// or hex text (see Parser::parseBuffer).
+bool compileBuffer(const void *data, size_t size, const CompileOptions &options,
+                   llvm::LLVMContext &context, std::vector<std::string> &outputs);
+
+// Load the execution graph of a program file (or a graph file) as compileFile would build it.
+bool loadProgramGraph(const std::string &inputFile, const CompileOptions &options, Graph &graph);
+
+// Generate the LLVM module of an execution graph as the options ask for it, for callers that
+// run or transform the module themselves.
+std::unique_ptr<llvm::Module> generateModule(const Graph &graph, const CompileOptions &options,
+                                             llvm::LLVMContext &context);
+
+#endif // DRIVER_H
@@ -1,24 +1,65 @@
 #ifndef GRAPH_H
 #define GRAPH_H
 
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include <utility>
 #include "PietTypes.h"
 
 // Each edge records the target node (a state) and the command executed to transition.
 struct GraphEdge {
-    int targetNode;      // index of the target GraphNode in the graph's node vector
+    uint32_t targetNode; // index of the target GraphNode in the graph's node array
     Command command;     // the command that was executed on the transition
+    uint8_t reserved[3]; // Zero; makes the padding explicit so serialized graphs are deterministic.
 };
 
 // Each GraphNode represents a program state: a particular block plus the DP and CC at that time.
+// Nodes are stored in compressed-sparse-row form: the transitions of a node are the numEdges
+// consecutive entries of the graph's edge array starting at firstEdge.
 struct GraphNode {
-    int id;              // Unique node id.
-    int blockId;         // The id of the corresponding color block (from connected components).
-    int blockSize;       // The number of codels in the block (for use in the Push command).
+    uint32_t blockId;    // The id of the corresponding color block (from connected components).
+    uint32_t blockSize;  // The number of codels in the block (for use in the Push command).
+    uint32_t firstEdge;  // Index of the node's first outgoing transition in the edge array.
+    uint16_t numEdges;   // Number of outgoing transitions (0 for a terminal state).
     Direction dp;        // The current direction pointer.
     CodelChooser cc;     // The current codel chooser.
-    std::vector<GraphEdge> transitions;  // One or more outgoing transitions.
+};
+
+// The outgoing transitions of one node.
+struct EdgeRange {
+    const GraphEdge *first;
+    const GraphEdge *last;
+    const GraphEdge *begin() const { return first; }
+    const GraphEdge *end() const { return last; }
+    size_t size() const { return last - first; }
+    bool empty() const { return first == last; }
+    const GraphEdge &operator[](size_t i) const { return first[i]; }
+};
+
+// An inclusive rectangle of codels (rows top..bottom, columns left..right); empty by default.
+struct CodelRect {
+    int top = 0, left = 0, bottom = -1, right = -1;
+    static CodelRect all(int rows, int cols) { return CodelRect{ 0, 0, rows - 1, cols - 1 }; }
+    bool empty() const { return bottom < top || right < left; }
+    bool contains(int r, int c) const { return r >= top && r <= bottom && c >= left && c <= right; }
+    bool intersects(const CodelRect &other) const {
+        return !empty() && !other.empty() && top <= other.bottom && other.top <= bottom &&
+               left <= other.right && other.left <= right;
+    }
+    // Grow the rectangle to include codel (r, c).
+    void add(int r, int c) {
+        if (empty()) {
+            *this = CodelRect{ r, c, r, c };
+            return;
+        }
+        top = r < top ? r : top;
+        bottom = r > bottom ? r : bottom;
+        left = c < left ? c : left;
+        right = c > right ? c : right;
+    }
 };
 
 class Graph {
@@ -26,21 +67,91 @@ public:
     Graph();
     // Build the execution graph from the grid of PietColors.
     void buildGraph(const std::vector<std::vector<PietColor>> &grid);
-    // Return the computed nodes.
-    const std::vector<GraphNode>& getNodes() const;
+    // Update a graph built from a grid after the codels in dirty changed (the grid keeps its
+    // size). Only blocks touching the dirty rectangle are relabeled and only states whose exits
+    // or white slides examined affected codels are explored again; node ids of the other states
+    // stay the same, and states that became unreachable remain as unreachable terminal nodes.
+    // Falls back to buildGraph if the start block changed, the grid changed size, the graph was
+    // minimized or loaded, or most node ids are unreachable. Returns the number of states explored.
+    int updateGraph(const std::vector<std::vector<PietColor>> &grid, const CodelRect &dirty);
+    // Merge behaviourally equivalent states: nodes that execute the same commands and lead to
+    // equivalent successors (Hopcroft's partition refinement). Node 0 stays the initial state.
+    // Returns the number of nodes removed.
+    int minimize();
+    // The part of the graph reachable from node start, with start as its node 0. Block ids and
+    // blockOrigin/blockColor stay those of this graph.
+    Graph subgraphFrom(int start) const;
+
+    // Number of nodes. Node 0 is the initial state.
+    size_t size() const;
+    bool empty() const;
+    const GraphNode& getNode(int id) const;
+    EdgeRange getTransitions(int id) const;
+    EdgeRange getTransitions(const GraphNode &node) const;
+    // The top-left codel (row, column) and the color of a block. Only available for a graph
+    // built from a grid, not for one loaded from a graph file.
+    std::pair<int,int> blockOrigin(int blockId) const;
+    PietColor blockColor(int blockId) const;
+    size_t numEdges() const;
+
+    // Serialize the graph in the binary graph file format (see GraphFileHeader).
+    void serialize(std::string &out) const;
+    // Write the graph in the binary graph file format. Returns true on success.
+    bool save(const std::string &filename) const;
+    // Memory-map a graph file written by save(). The node and edge arrays are used in place,
+    // without deserialization. Returns false if the file is missing or malformed.
+    bool load(const std::string &filename);
+    // Returns true if the file starts with the graph file magic.
+    static bool isGraphFile(const std::string &filename);
 private:
     // A “block” is a connected region (by 4–connectivity) of codels having the same color.
+    // A block retired by updateGraph has no cells (size 0).
     struct Block {
         int id;
         PietColor color;
         int size;
+        std::pair<int,int> origin;             // The top-left codel (first in row-major order).
         std::vector<std::pair<int,int>> cells; // (row, col) coordinates in the grid.
     };
+    // A built graph owns its arrays; a loaded one points into the mapped file instead.
     std::vector<GraphNode> nodes;
-    std::vector<Block> blocks; // Computed connected color blocks.
+    std::vector<GraphEdge> edges;
+    std::shared_ptr<const void> mapping; // Keeps the mapped graph file alive.
+    const GraphNode *mappedNodes = nullptr;
+    const GraphEdge *mappedEdges = nullptr;
+    size_t mappedNumNodes = 0, mappedNumEdges = 0;
+    std::vector<Block> blocks; // Connected color blocks labeled so far, in order of discovery.
+    // The codel map: the block id of every codel (row-major), or -1 while it is unlabeled.
+    std::vector<int> labels;
+    int labelRows = 0, labelCols = 0;
+    // For incremental updates of a graph built from a grid: the node id of every state, keyed by
+    // (blockId, dp, cc), and the codels examined when leaving each state's block.
+    std::unordered_map<uint64_t, uint32_t> stateIds;
+    std::vector<CodelRect> footprints;
+    size_t unreachableNodes = 0;
+
+    const GraphNode *nodeData() const;
+    const GraphEdge *edgeData() const;
     
-    // Compute connected color blocks from the grid.
-    void computeBlocks(const std::vector<std::vector<PietColor>> &grid);
+    // How execution leaves a block with a given DP and CC: the codel entered (if any), whether
+    // it was reached by sliding through white, the DP and CC after retries, and the bounding box
+    // of the codels examined outside the block.
+    struct StateExit {
+        bool found = false;
+        std::pair<int,int> target;
+        bool slid = false;
+        Direction dp = Direction::Right;
+        CodelChooser cc = CodelChooser::Left;
+        CodelRect footprint;
+    };
+    StateExit exploreState(const Block &block, Direction dp, CodelChooser cc,
+                           const std::vector<std::vector<PietColor>> &grid);
+    // Explore the states reachable from the initial state, reusing the transitions of existing
+    // states whose footprint misses dirty. Returns the number of states explored.
+    int explore(const std::vector<std::vector<PietColor>> &grid, const CodelRect &dirty);
+    // Return the id of the block containing codel (r,c), flood-filling and labeling the block
+    // first if none of its codels has been labeled yet.
+    int labelBlock(int r, int c, const std::vector<std::vector<PietColor>> &grid);
     // Given two colors (from and to), compute the Piet command according to the specification.
     Command getCommand(PietColor from, PietColor to);
 
@@ -50,7 +161,8 @@ private:
                                       const std::vector<std::vector<PietColor>> &grid);
     // Given a coordinate and a DP, return the adjacent coordinate in that direction.
     std::pair<int,int> getNextCodel(const std::pair<int,int>& coord, Direction dp);
-    // Given a coordinate (r,c), return the id of the block that contains that coordinate, or -1 if none.
+    // Given a coordinate (r,c), return the id of the labeled block that contains that coordinate,
+    // or -1 if none.
     int findBlockId(int r, int c) const;
     // Rotate a given DP by (clockwise) n steps.
     Direction rotateDP(Direction dp, int steps);
@@ -58,4 +170,16 @@ private:
     CodelChooser toggleCC(CodelChooser cc);
 };
 
+// Layout of a graph file: this header, then numNodes GraphNodes at nodesOffset and numEdges
+// GraphEdges at edgesOffset (both 16-byte aligned), all in host (little-endian) byte order.
+struct GraphFileHeader {
+    char magic[8];        // "PIETGRF\0"
+    uint32_t version;     // kGraphFileVersion
+    uint32_t numNodes;
+    uint32_t numEdges;
+    uint32_t reserved;
+    uint64_t nodesOffset;
+    uint64_t edgesOffset;
+};
+
 #endif // GRAPH_H
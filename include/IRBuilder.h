@@ -1,17 +1,171 @@
 #ifndef IRBUILDER_H
 #define IRBUILDER_H
 
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
 #include "Graph.h"
+#include "StackBounds.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/LLVMContext.h"
 
+namespace llvm {
+class BasicBlock;
+class Constant;
+class Function;
+class FunctionType;
+class IRBuilderBase;
+class StructType;
+class Value;
+}
+
 class IRGenerator {
 public:
     IRGenerator(llvm::LLVMContext &ctx);
-    // Generate an LLVM module from the given graph.
+    // Graphs with at least this many nodes are partitioned into several functions
+    // (0 always partitions, a negative value never does).
+    void setPartitionThreshold(int threshold);
+    // Record every node executed with the trace runtime (see PietTrace.h).
+    void setTrace(bool enabled);
+    // Run programs whose stack depth is not bounded on a guarded stack (see createGuardedStack),
+    // so that every push is inlined without a capacity check.
+    void setGuardedStack(bool enabled);
+    // Give every run a budget of fuel loop iterations (0: unlimited). Only back edges of the
+    // graph (see findBackEdges) take fuel, so code between them runs unchecked. A run that uses
+    // it up returns PIET_OUT_OF_FUEL (see PietRuntime.h). Budgets above LLONG_MAX, the most
+    // piet_ctx::fuel holds, are clamped to it.
+    void setFuel(uint64_t budget);
+    // Start every run with this output already written and this stack (bottom first) on node 0:
+    // the state reached by the program's prefix evaluated at compile time (see PartialEval.h).
+    void setInitialState(const std::vector<int> &stack, const std::string &output);
+    // Generate an LLVM module from the given graph. It defines the re-entrant entry point
+    // "i32 piet_run(piet_ctx*)" (see PietRuntime.h) and a main that runs it on stdin/stdout.
     llvm::Module* generateModule(const Graph &graph);
+    // Incremental code generation (see --watch). The graph is split into regions of regionSize
+    // consecutive node ids, and every region function goes into a module of its own; both are
+    // named "piet_region_<hash of its code>". Modules of regions for which haveRegion(name) returns
+    // true are dropped (the caller already has that code); the others are appended to
+    // regionModules. Returns the module defining "i32 <runName>(piet_ctx*)", which calls the
+    // regions by name. Node ids that stay stable across edits keep most regions unchanged.
+    llvm::Module *generateIncremental(const Graph &graph, int regionSize, const std::string &runName,
+                                      const std::function<bool(const std::string&)> &haveRegion,
+                                      std::vector<std::unique_ptr<llvm::Module>> &regionModules);
+    // Tiered execution (see TieredProgram.h). prepareRegions analyzes the graph once; then
+    // generateRegion generates the function of one region into a module of its own, as
+    // "i32 <name>(i8* stack, i8* ctx, i32 entryNode)". The function can be entered at any node
+    // of the region, and returns the next node id when control leaves the region, -1 once the
+    // program terminates, or kRegionOutOfFuel.
+    void prepareRegions(const Graph &graph);
+    llvm::Module *generateRegion(const Graph &graph, const std::vector<int> &nodeRegion, int region,
+                                 const std::string &name);
+    // The stack that code generated since prepareRegions expects a run to start on: a guarded
+    // stack (pietPrepareGuardedStack), or one with room for stackCapacity() values
+    // (pietPrepareStack).
+    bool usesGuardedStack() const { return useGuardedStack; }
+    int stackCapacity() const { return uncheckedPush ? preallocatedDepth : 0; }
 private:
     llvm::LLVMContext &context;
+    int partitionThreshold;
+    bool trace = false;
+    bool guardedStack = false;
+    uint64_t fuel = 0;
+    std::vector<int> initialStack;
+    std::string initialOutput;
+    // Stack depth interval on entry to each node of the graph being generated.
+    std::vector<DepthInterval> depthBounds;
+    // With a fuel budget, the back edges of the graph being generated (see findBackEdges).
+    std::vector<bool> backEdges;
+    // The stack is preallocated to the proven maximum depth, or guarded, so pushes need no
+    // capacity check.
+    bool uncheckedPush = false;
+    int preallocatedDepth = 0;
+    bool useGuardedStack = false;
+
+    // Runtime functions declared in the module being generated.
+    llvm::Function *stackPushF = nullptr;
+    llvm::Function *stackPopF = nullptr;
+    llvm::Function *stackRollF = nullptr;
+    llvm::Function *prepareStackF = nullptr;
+    llvm::Function *prepareGuardedStackF = nullptr;
+    llvm::Function *stackLoadF = nullptr;
+    llvm::Function *writeOutputF = nullptr;
+    llvm::Function *createStdioContextF = nullptr;
+    llvm::Function *destroyContextF = nullptr;
+    llvm::Function *inputCharF = nullptr;
+    llvm::Function *inputNumF = nullptr;
+    llvm::Function *outputCharF = nullptr;
+    llvm::Function *outputNumF = nullptr;
+    llvm::Function *traceStartF = nullptr;
+    llvm::Function *traceF = nullptr;
+    llvm::StructType *stackTy = nullptr;
+
+    void declareRuntime(llvm::Module *module);
+    // Compute the depth bounds and, with a fuel budget, the back edges of the graph, and decide
+    // how the stack is allocated.
+    void analyzeGraph(const Graph &graph);
+    // Get the stack of the run's context, preallocated if the maximum depth is known (otherwise
+    // guarded, if enabled), start tracing and set up the initial state.
+    llvm::Value *emitPrepareStack(llvm::IRBuilderBase &builder, llvm::Value *ctx, const Graph &graph);
+    // With tracing enabled, record the execution of node id.
+    void emitTrace(llvm::IRBuilderBase &builder, llvm::Value *stack, const Graph &graph, int id);
+    // Pop a value; with unchecked set the stack is known to be non-empty and the pop is inlined.
+    llvm::Value *emitPop(llvm::IRBuilderBase &builder, llvm::Value *stack, bool unchecked);
+    // Push a value, inlined when the stack was preallocated.
+    void emitPush(llvm::IRBuilderBase &builder, llvm::Value *stack, llvm::Value *value);
+    // The block an edge from node `from` to target branches to: targetBB, or, on a back edge
+    // under a fuel budget, a block that takes one unit of fuel first and branches to outOfFuel
+    // (created on first use, returning outOfFuelStatus) if there is none left. checks caches the
+    // blocks of one node's edges.
+    llvm::BasicBlock *edgeTarget(const Graph &graph, int from, int target, llvm::BasicBlock *targetBB,
+                                 llvm::Value *ctx, std::map<int, llvm::BasicBlock*> &checks,
+                                 llvm::BasicBlock *&outOfFuel, int outOfFuelStatus);
+    // Emit the command and the outgoing branch of one node at the builder's insertion point.
+    // successor(id) returns the block to jump to for node id; terminate() ends a terminal node.
+    // depth is the node's entry stack depth interval; pops it proves safe are unchecked.
+    // ctx is the run's piet_ctx, used for input and output.
+    void emitNode(llvm::IRBuilderBase &builder, const GraphNode &node, EdgeRange transitions,
+                  const DepthInterval &depth, llvm::Value *stack, llvm::Value *ctx,
+                  const std::function<llvm::BasicBlock*(int)> &successor,
+                  const std::function<void()> &terminate);
+    // Put every node into a single piet_run function with one basic block per node.
+    llvm::Function *generateSingleFunction(llvm::Module *module, const Graph &graph);
+    // Put each region of strongly connected components into its own function,
+    // driven by a dispatch loop in piet_run.
+    llvm::Function *generatePartitioned(llvm::Module *module, const Graph &graph);
+    // The type of region functions: "i32 (i8* stack, i8* ctx, i32 entryNode)". A region function
+    // runs until control leaves the region and returns the next node id, -1 once the program
+    // terminates, or kRegionOutOfFuel.
+    llvm::FunctionType *regionFunctionType();
+    // Emit the body of the function of the region made of regionNodes. bbNodes is scratch space
+    // indexed by node id.
+    void emitRegion(llvm::Function *func, const Graph &graph, const std::vector<int> &nodeRegion,
+                    const std::vector<int> &regionNodes, const std::vector<bool> &isEntry,
+                    std::vector<llvm::BasicBlock*> &bbNodes);
+    // Define the entry point `name`, a loop that calls the function of the current node's region
+    // until the program terminates.
+    llvm::Function *emitDispatch(llvm::Module *module, const Graph &graph,
+                                 const std::vector<int> &nodeRegion,
+                                 const std::vector<llvm::Constant*> &regionFuncs,
+                                 const std::string &name);
+    // main: run piet_run once on a context bound to stdin/stdout.
+    void generateMain(llvm::Module *module, llvm::Function *run);
 };
 
+// Region functions return this when the run's fuel is used up (see IRGenerator::setFuel).
+static const int kRegionOutOfFuel = -2;
+
+// Find the back edges of a depth-first search of the graph (from node 0, then from any node not
+// reached yet): edges to a node still on the search path. Every cycle contains one. Returns a
+// flag per edge, indexed like the graph's edge array.
+std::vector<bool> findBackEdges(const Graph &graph);
+
+// Split a graph into regions for code generation: strongly connected components are taken in
+// topological order and packed into regions of at most maxRegionNodes nodes (a larger component
+// gets a region of its own). Control only flows from a region to later regions.
+// Returns the region index of every node.
+std::vector<int> partitionGraph(const Graph &graph, int maxRegionNodes);
+
 #endif // IRBUILDER_H
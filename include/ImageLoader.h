@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <cstddef>
 #include <cstdint>
 
 // Structure holding image data.
@@ -16,4 +17,7 @@ struct Image {
 // Loads an image (bmp/png/gif) from file. Returns true on success.
 bool loadImage(const std::string &filename, Image &image);
 
+// Decodes an image (bmp/png/gif) held in memory. Returns true on success.
+bool loadImageFromMemory(const uint8_t *data, size_t size, Image &image);
+
 #endif // IMAGE_LOADER_H
@@ -0,0 +1,96 @@
+#ifndef JIT_PROGRAM_H
+#define JIT_PROGRAM_H
+
+#include <memory>
+#include <map>
+#include <string>
+#include <vector>
+#include "Driver.h"
+#include "Graph.h"
+#include "PietRuntime.h"
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+
+namespace llvm {
+namespace orc {
+class LLJIT;
+class ResourceTracker;
+class ThreadSafeContext;
+}
+}
+
+class Graph;
+
+// Create an ORC LLJIT for generated code: the runtime resolves to this process's copy of it,
+// and anything else (libc) through the process's symbol table. Returns null, after reporting
+// why, on failure.
+std::unique_ptr<llvm::orc::LLJIT> createProgramJIT();
+
+// A Piet program compiled to native code in this process (with ORC LLJIT), linked against the
+// runtime built into the library. Its piet_run entry is re-entrant: any number of threads may
+// run it at the same time, each on its own piet_ctx.
+class JITProgram {
+public:
+    ~JITProgram();
+    // Compile a program (any input compileFile accepts, including graph files). Returns null,
+    // after reporting why, on failure.
+    static std::unique_ptr<JITProgram> compileFile(const std::string &inputFile,
+                                                   const CompileOptions &options);
+    // Compile an execution graph.
+    static std::unique_ptr<JITProgram> compileGraph(const Graph &graph, const CompileOptions &options);
+
+    // The program's piet_run.
+    piet_run_fn entry() const { return run; }
+    // Run the program once on an input held in memory and return its output.
+    std::string runOnInput(const char *input, size_t size) const;
+
+private:
+    JITProgram() = default;
+    std::unique_ptr<llvm::orc::LLJIT> jit;
+    piet_run_fn run = nullptr;
+};
+
+// A program that is recompiled in place as its codel grid is edited (see --watch). Each update
+// explores only the graph states whose codels changed (Graph::updateGraph) and JIT-compiles only
+// the regions whose generated code changed (IRGenerator::generateIncremental); unchanged regions
+// keep the native code compiled for an earlier version, and regions no longer used are freed. The
+// graph is not minimized and no prefix is evaluated at compile time, since either would renumber
+// the nodes on every edit.
+class IncrementalProgram {
+public:
+    ~IncrementalProgram();
+    // Returns null, after reporting why, if the JIT cannot be created.
+    static std::unique_ptr<IncrementalProgram> create(const CompileOptions &options);
+
+    // Compile the program for a new version of its grid. Returns false on failure; the previous
+    // entry stays valid then.
+    bool update(const std::vector<std::vector<PietColor>> &grid);
+
+    // The piet_run of the latest version. It remains valid until the next successful update.
+    piet_run_fn entry() const { return run; }
+
+    // What the latest update did.
+    struct UpdateStats {
+        size_t exploredStates = 0; // States whose transitions were computed again.
+        size_t states = 0;         // Nodes of the graph.
+        size_t compiledRegions = 0; // Regions whose code was compiled.
+        size_t regions = 0;        // Regions of the graph.
+    };
+    const UpdateStats &lastUpdate() const { return stats; }
+
+private:
+    IncrementalProgram() = default;
+    CompileOptions options;
+    std::unique_ptr<llvm::orc::LLJIT> jit;
+    // Owns the module of the current entry point; removing it frees the code of the previous one.
+    llvm::IntrusiveRefCntPtr<llvm::orc::ResourceTracker> entryTracker;
+    Graph graph;
+    std::vector<std::vector<PietColor>> grid;
+    // The region functions in the JIT, by name; each owns the module it was compiled from, and is
+    // removed once the current entry point no longer calls it.
+    std::map<std::string, llvm::IntrusiveRefCntPtr<llvm::orc::ResourceTracker>> regionTrackers;
+    unsigned generation = 0;
+    piet_run_fn run = nullptr;
+    UpdateStats stats;
+};
+
+#endif // JIT_PROGRAM_H
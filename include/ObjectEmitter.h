@@ -0,0 +1,17 @@
+#ifndef OBJECT_EMITTER_H
+#define OBJECT_EMITTER_H
+
+#include <vector>
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+// Register the host target with LLVM (once per process; thread-safe).
+void initializeHostTarget();
+
+// Compile a module to native object code for the host. With more than one output stream the
+// module is split into that many parts, which are code generated in parallel (one thread per
+// part); linking all of the objects together is equivalent to the single-object result.
+// Returns true on success.
+bool emitObjects(llvm::Module &module, const std::vector<llvm::raw_pwrite_stream*> &outputs);
+
+#endif // OBJECT_EMITTER_H
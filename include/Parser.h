@@ -1,22 +1,54 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include "PietTypes.h"
+#include "ImageLoader.h"
 
 class Parser {
 public:
     Parser();
     // Parses an input file.
     // If the filename ends with .bmp, .png, or .gif, it is interpreted as an image.
+    // A file starting with the codel file magic is read as a packed codel file.
     // Otherwise, it is parsed as a text file with whitespace-separated hex color codes.
     bool parseFile(const std::string &filename);
+    // Parses a program held in memory, without touching the filesystem: a PNG, BMP or GIF
+    // image (recognized by its signature), a packed codel file, or hex text.
+    bool parseBuffer(const void *data, size_t size);
+    // Uses a codel grid built by the caller.
+    void setGrid(std::vector<std::vector<PietColor>> codels);
     // Returns the parsed grid (rows of codels)
     const std::vector<std::vector<PietColor>>& getGrid() const;
 
+    // Serialize a grid in the packed codel file format (see CodelFileHeader).
+    static void writeCodels(const std::vector<std::vector<PietColor>> &grid, std::string &out);
+    // Write a grid in the packed codel file format. Returns true on success.
+    static bool saveCodelFile(const std::string &filename,
+                              const std::vector<std::vector<PietColor>> &grid);
+    // Returns true if the file starts with the codel file magic.
+    static bool isCodelFile(const std::string &filename);
+
 private:
     std::vector<std::vector<PietColor>> grid;
+
+    void parseImage(const Image &image);
+    void parseText(const char *data, size_t size);
+    // name identifies the input in diagnostics.
+    bool parseCodels(const char *data, size_t size, const std::string &name);
+};
+
+// Layout of a codel file: this header, then height rows of width codels. Each codel is 5 bits
+// (its PietColor value, or kCodelPadding past the end of a row shorter than width), packed
+// least significant bit first; every row starts on a byte boundary.
+struct CodelFileHeader {
+    char magic[8];        // "PIETCDL\0"
+    uint32_t version;     // kCodelFileVersion
+    uint32_t width;       // Length of the longest row.
+    uint32_t height;      // Number of rows.
+    uint32_t reserved;
 };
 
 #endif // PARSER_H
@@ -0,0 +1,31 @@
+#ifndef PARTIAL_EVAL_H
+#define PARTIAL_EVAL_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Graph.h"
+#include "StackVM.h"
+
+// The state a program reaches after running its input-free prefix at compile time.
+struct ProgramPrefix {
+    int node = 0;             // The node execution continues from.
+    std::vector<int> stack;   // The stack on entry to node, bottom first.
+    std::string output;       // Everything written before reaching node.
+    uint64_t steps = 0;       // Nodes executed (0: nothing could be evaluated).
+    bool terminated = false;  // The program ended within the prefix (node is terminal).
+};
+
+// Run a graph from its initial state exactly as the generated code would, until a node reads
+// input, a division would trap (by zero, or INT_MIN by -1), the program ends, or maxSteps
+// nodes, the stack budget or the output budget are exhausted. Execution can then continue
+// from the returned state.
+ProgramPrefix evaluatePrefix(const Graph &graph, uint64_t maxSteps);
+
+// Execute a command that only touches the stack exactly as the generated code does: arithmetic
+// wraps around, and a division that traps in generated code (by zero, or INT_MIN by -1) raises
+// SIGFPE. blockSize is the value Push pushes. Input and output commands are left to the caller:
+// for those nothing is done and false is returned.
+bool executeStackCommand(Stack *stack, Command command, int blockSize);
+
+#endif // PARTIAL_EVAL_H
@@ -0,0 +1,88 @@
+#ifndef PIET_RUNTIME_H
+#define PIET_RUNTIME_H
+
+#include <cstddef>
+#include <cstdio>
+#include "StackVM.h"
+
+// The execution context of one run of a compiled program.
+//
+// Every program exports "int piet_run(piet_ctx *ctx)" besides main. A run keeps all of its
+// state in the context (the stack and the input/output streams), so any number of contexts can
+// be run at the same time, on any threads, by one compiled or JIT-compiled program.
+// main runs once on a context bound to stdin/stdout.
+//
+// The runtime is linked into standalone compiled programs, which have no DiagnosticHandler, so
+// its few fatal errors are written straight to stderr rather than through reportError.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct piet_ctx {
+    Stack *stack;             // Created by the first run; emptied at the start of every run.
+    const char *input;        // Input bytes (ignored for a stdio context).
+    size_t inputSize;
+    size_t inputPos;          // Next input byte to read.
+    char *output;             // Output written so far (not used by a stdio context).
+    size_t outputSize;
+    size_t outputCapacity;
+    int stdio;                // Non-zero: read `in` and write `out` instead of the buffers.
+    long long fuel;           // Loop iterations left in a run of a program compiled with a fuel
+                              // budget (set by piet_run; generated code updates it in place).
+    FILE *in;                 // The streams of a stdio context.
+    FILE *out;
+};
+
+// The signature of piet_run. It returns 0 once the program terminates, or PIET_OUT_OF_FUEL if a
+// program compiled with a fuel budget (see --fuel) used it up; the output written until then is
+// kept.
+typedef int (*piet_run_fn)(piet_ctx *ctx);
+
+#define PIET_OUT_OF_FUEL 3
+
+// Create a context that reads input from a buffer (not copied; it must outlive the runs) and
+// collects output in memory.
+piet_ctx* pietCreateContext(const char *input, size_t inputSize);
+
+// Create a context bound to stdin and stdout.
+piet_ctx* pietCreateStdioContext();
+
+// Create a context bound to the given streams (not closed by pietDestroyContext).
+piet_ctx* pietCreateStreamContext(FILE *in, FILE *out);
+
+// Destroy a context and its stack.
+void pietDestroyContext(piet_ctx *ctx);
+
+// Rewind the input and discard the output, to run a context again on the same input.
+void pietResetContext(piet_ctx *ctx);
+
+// --- Called by generated code ---
+
+// Return the context's stack, emptied, with room for at least capacity values.
+Stack* pietPrepareStack(piet_ctx *ctx, int capacity);
+
+// Return the context's stack, emptied, as a guarded stack (see createGuardedStack): pushes need
+// no capacity check however deep the stack grows. Aborts if no guarded stack can be created.
+Stack* pietPrepareGuardedStack(piet_ctx *ctx);
+
+// Write length bytes of output at once (the output of the prefix evaluated at compile time).
+void pietWriteOutput(piet_ctx *ctx, const char *bytes, int length);
+
+// Read a character (one byte) and push it; at the end of the input nothing is pushed.
+void pietInputChar(piet_ctx *ctx);
+
+// Read a decimal integer (after optional whitespace) and push it; nothing is pushed if there is none.
+void pietInputNum(piet_ctx *ctx);
+
+// Write the low byte of value as a character.
+void pietOutputChar(piet_ctx *ctx, int value);
+
+// Write value in decimal.
+void pietOutputNum(piet_ctx *ctx, int value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PIET_RUNTIME_H
@@ -0,0 +1,53 @@
+#ifndef PIET_TRACE_H
+#define PIET_TRACE_H
+
+#include <cstdint>
+#include "StackVM.h"
+
+// Execution tracing for programs compiled with --trace.
+//
+// Every graph node executed records (node id, command, top of stack) into a buffer owned by the
+// running thread; no locks or atomics are involved. A full buffer is appended to the trace file
+// as one chunk with a single write, and the rest is flushed when the thread or program exits or
+// when the program is killed by a signal. The trace file is $PIETRIC_TRACE_FILE, or piet.trace.
+
+// Layout of a trace file: this header, then any number of chunks, each a TraceChunkHeader
+// followed by count TraceRecords, all in host (little-endian) byte order. The chunks of one
+// thread appear in execution order.
+struct TraceFileHeader {
+    char magic[8];        // "PIETTRC\0"
+    uint32_t version;     // kTraceFileVersion
+    uint32_t numNodes;    // Number of nodes of the traced program's graph.
+};
+
+struct TraceChunkHeader {
+    uint32_t thread;      // Index of the thread that executed the records (0, 1, ... in order of first use).
+    uint32_t count;       // Number of records in the chunk.
+};
+
+struct TraceRecord {
+    uint32_t node;        // Graph node id.
+    int32_t top;          // Top of the stack on entry to the node (0 if the stack is empty).
+    uint8_t command;      // The Command the node executes (None for a terminal node).
+    uint8_t reserved[3];
+};
+
+static const char kTraceFileMagic[8] = { 'P', 'I', 'E', 'T', 'T', 'R', 'C', 0 };
+static const uint32_t kTraceFileVersion = 1;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Open the trace file and write its header (once per process). Called on entry to main. Like the
+// rest of the runtime, it reports a trace file it cannot open on stderr (not via reportError).
+void pietTraceStart(int numNodes);
+
+// Record the execution of a node.
+void pietTrace(Stack* stack, int node, int command);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PIET_TRACE_H
@@ -1,6 +1,7 @@
 #ifndef PIET_TYPES_H
 #define PIET_TYPES_H
 
+#include <cstdint>
 #include <string>
 
 // The 20 Piet colors (plus a catch–all Undefined)
@@ -13,17 +14,17 @@ enum class PietColor {
 };
 
 // Direction pointer values (DP)
-enum class Direction {
+enum class Direction : uint8_t {
     Right, Down, Left, Up
 };
 
 // Codel chooser states (CC)
-enum class CodelChooser {
+enum class CodelChooser : uint8_t {
     Left, Right
 };
 
 // Piet command set
-enum class Command {
+enum class Command : uint8_t {
     None,       // No command (or no operation)
     Push, 
     Pop, 
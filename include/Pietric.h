@@ -0,0 +1,21 @@
+#ifndef PIETRIC_H
+#define PIETRIC_H
+
+// libpietric: the compiler as a library.
+//
+// Compile a program held in memory (compileBuffer) or a codel grid (compileGrid) into LLVM IR,
+// object code, a graph file or a codel file, without touching the filesystem. Diagnostics go to
+// CompileOptions::diagnostics (or a DiagnosticScope) instead of the console. The pipeline
+// stages (Parser, Graph, IRGenerator, emitObjects) can also be used on their own.
+
+#include "Diagnostics.h"
+#include "Driver.h"
+#include "Graph.h"
+#include "IRBuilder.h"
+#include "JITProgram.h"
+#include "ObjectEmitter.h"
+#include "Parser.h"
+#include "PietTypes.h"
+#include "ProgramCache.h"
+
+#endif // PIETRIC_H
@@ -0,0 +1,22 @@
+#ifndef PIXEL_KERNELS_H
+#define PIXEL_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Data-parallel kernels over packed RGB pixel data (3 bytes per pixel).
+// On x86 the best of AVX2, SSE4.1 and a scalar fallback is selected at run time; setting the
+// environment variable PIETRIC_SIMD to "scalar", "sse4.1" or "avx2" restricts the choice.
+
+// Classify count pixels into Piet color indices (the values of PietColor). A pixel whose
+// channels are not all 0x00, 0xC0 or 0xFF, or which is not one of the 20 Piet colors,
+// becomes PietColor::Undefined.
+void classifyPixels(const uint8_t *rgb, size_t count, uint8_t *out);
+
+// Returns true if every one of the count pixels starting at rgb equals the pixel at reference.
+bool pixelsMatch(const uint8_t *rgb, size_t count, const uint8_t *reference);
+
+// The name of the kernel set in use ("avx2", "sse4.1" or "scalar").
+const char *pixelKernelName();
+
+#endif // PIXEL_KERNELS_H
@@ -0,0 +1,66 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Graph.h"
+#include "PietTypes.h"
+
+// An in-memory cache of parsed codel grids and built execution graphs, shared by the
+// compilations of a long-running process (see --daemon and CompileOptions::programCache).
+// Grids are keyed by file and parsed again once the file changes; graphs are keyed by the
+// contents of their grid, so copies of a program share one graph. Each table keeps its
+// maxEntries most recently used entries. All methods are thread-safe.
+class ProgramCache {
+public:
+    explicit ProgramCache(size_t maxEntries = 1024);
+    ProgramCache(const ProgramCache &) = delete;
+    ProgramCache &operator=(const ProgramCache &) = delete;
+
+    // The codel grid of a program file (an image, codel or text file), parsed on first use and
+    // whenever the file's size or modification time changes. Returns null, after reporting why,
+    // if the file cannot be parsed.
+    std::shared_ptr<const std::vector<std::vector<PietColor>>> grid(const std::string &path);
+    // The execution graph of a grid, built (and minimized if asked for) on first use.
+    std::shared_ptr<const Graph> graph(const std::vector<std::vector<PietColor>> &grid, bool minimize);
+
+    struct Stats {
+        uint64_t gridHits = 0, gridMisses = 0;
+        uint64_t graphHits = 0, graphMisses = 0;
+    };
+    Stats stats() const;
+
+private:
+    // A table of the most recently used values, most recent first.
+    template <typename Value>
+    struct Table {
+        struct Entry {
+            std::string key;
+            std::string version;    // Grids: the file's identity, size and modification time.
+            std::shared_ptr<const Value> value;
+        };
+        std::list<Entry> entries;
+        std::unordered_map<std::string, typename std::list<Entry>::iterator> index;
+    };
+
+    size_t maxEntries;
+    mutable std::mutex mutex;
+    Table<std::vector<std::vector<PietColor>>> grids;
+    Table<Graph> graphs;
+    Stats counters;
+
+    template <typename Value>
+    std::shared_ptr<const Value> find(Table<Value> &table, const std::string &key,
+                                      const std::string &version);
+    template <typename Value>
+    void insert(Table<Value> &table, const std::string &key, const std::string &version,
+                std::shared_ptr<const Value> value);
+};
+
+#endif // PROGRAM_CACHE_H
@@ -0,0 +1,31 @@
+#ifndef STACK_BOUNDS_H
+#define STACK_BOUNDS_H
+
+#include <climits>
+#include <vector>
+#include "Graph.h"
+
+// Upper bound of a depth interval that is not bounded.
+static const int kUnboundedDepth = INT_MAX;
+
+// The range of stack depths possible on entry to a graph node.
+struct DepthInterval {
+    int lo = 0;                  // Minimum depth.
+    int hi = -1;                 // Maximum depth, or kUnboundedDepth; hi < lo if unreachable.
+    bool reachable() const { return hi >= lo; }
+    bool bounded() const { return hi != kUnboundedDepth; }
+};
+
+// The number of values an edge command pops and then pushes (between minPushes and maxPushes,
+// depending on the input), as generated by IRGenerator. Popping an empty stack yields 0 and
+// leaves it empty.
+void stackEffect(Command command, int &pops, int &minPushes, int &maxPushes);
+
+// Compute the stack depth interval on entry to every node of the graph, starting from
+// initialDepth values at node 0, by abstract interpretation over intervals (widened in loops).
+std::vector<DepthInterval> computeStackBounds(const Graph &graph, int initialDepth = 0);
+
+// The largest stack depth reached anywhere in the graph, or kUnboundedDepth.
+int maxStackDepth(const Graph &graph, const std::vector<DepthInterval> &bounds);
+
+#endif // STACK_BOUNDS_H
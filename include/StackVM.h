@@ -1,20 +1,33 @@
 #ifndef STACK_VM_H
 #define STACK_VM_H
 
-#include <vector>
-
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// A simple Stack structure.
+// A simple Stack structure: a growable array of values, the top at data[size - 1].
+// Generated code accesses the fields directly (as { i32*, i32, i32, i32 }) for the pushes and
+// pops that the stack depth analysis proves safe, so the layout is part of the runtime ABI.
 struct Stack {
-    std::vector<int> data;
+    int *data;
+    int size;
+    int capacity;
+    int guarded;    // Non-zero for a guarded stack (see createGuardedStack).
 };
 
 // Create a new stack and return a pointer to it.
 Stack* createStack();
 
+// Create a new stack with room for capacity values, so that no push up to that depth reallocates.
+Stack* createStackWithCapacity(int capacity);
+
+// Create a guarded stack: a reservation of address space for 2^28 values (1 GiB), committed
+// on demand and followed by a guard page, so that pushes need no capacity check and the stack
+// never moves. Touching the uncommitted part of the reservation commits more of it from a
+// SIGSEGV handler; running into the guard page aborts with a stack overflow error.
+// Returns null if the address space cannot be reserved.
+Stack* createGuardedStack();
+
 // Destroy a stack.
 void destroyStack(Stack* stack);
 
@@ -29,6 +42,9 @@ int stackPop(Stack* stack);
 // (If rolls is negative, rotate in the opposite direction.)
 void stackRoll(Stack* stack, int rolls, int depth);
 
+// Replace the contents of the stack with count values (bottom first), growing it if needed.
+void stackLoad(Stack* stack, const int *values, int count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,96 @@
+#ifndef TIERED_PROGRAM_H
+#define TIERED_PROGRAM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Driver.h"
+#include "Graph.h"
+#include "PietRuntime.h"
+
+namespace llvm {
+namespace orc {
+class LLJIT;
+class ThreadSafeContext;
+}
+}
+
+class IRGenerator;
+
+// A program run in two tiers. Runs start at once in an interpreter that walks the execution
+// graph, and count the nodes each region executes (regions as in partitionGraph). A region
+// that executes hotThreshold nodes is queued for compilation with the ORC JIT on a background
+// thread. Runs then enter its native code at the next node boundary in the region. Both tiers
+// work on the same stack, so short runs never wait for LLVM, and long runs end up running
+// compiled code.
+//
+// run is re-entrant: any number of threads may run the program at the same time, each on its
+// own piet_ctx, and they share the region counters and the compiled code.
+class TieredProgram {
+public:
+    ~TieredProgram();
+    // Load a program (any input compileFile accepts, including graph files). Returns null, after
+    // reporting why, on failure or if options.trace is set. A threshold of 0 is taken as 1.
+    static std::unique_ptr<TieredProgram> loadFile(const std::string &inputFile,
+                                                   const CompileOptions &options,
+                                                   uint64_t hotThreshold);
+
+    // Run the program once on ctx, like piet_run (CompileOptions::fuel applies to both tiers).
+    int run(piet_ctx *ctx);
+
+    struct Stats {
+        size_t regions = 0;
+        size_t compiledRegions = 0;     // Regions whose native code is in use.
+        uint64_t interpretedNodes = 0;  // Nodes executed by the interpreter, over all runs.
+    };
+    Stats stats() const;
+
+private:
+    TieredProgram() = default;
+    // The code of one region: "i32 (Stack*, piet_ctx*, i32 node)" (see generateRegion).
+    typedef int (*RegionFn)(Stack *stack, piet_ctx *ctx, int node);
+    // Per-region state, on a cache line of its own since every interpreted node updates it.
+    struct alignas(64) Region {
+        // Nodes executed by the interpreter. Runs on different threads may lose each other's
+        // increments: the count only has to be roughly right, and a plain load and store is
+        // much cheaper than an atomic increment on every node.
+        std::atomic<uint64_t> executed{0};
+        std::atomic<bool> queued{false};
+        std::atomic<RegionFn> code{nullptr};
+    };
+
+    Graph graph;
+    std::vector<int> nodeRegion;
+    std::unique_ptr<Region[]> regions;
+    size_t numRegions = 0;
+    uint64_t hotThreshold = 1;
+    bool guardedStack = false;
+    int stackCapacity = 0;
+    uint64_t fuel = 0;
+    std::vector<bool> backEdges;    // With a fuel budget (see findBackEdges).
+
+    // The background compiler. Only its thread uses the generator and the JIT after creation.
+    std::unique_ptr<llvm::orc::ThreadSafeContext> context;
+    std::unique_ptr<IRGenerator> irgen;
+    std::unique_ptr<llvm::orc::LLJIT> jit;
+    std::thread compiler;
+    std::mutex queueMutex;
+    std::condition_variable queueReady;
+    std::deque<int> queue;          // Regions waiting to be compiled.
+    bool stopping = false;
+    std::atomic<size_t> compiled{0};
+
+    // Execute one node in the interpreter. Returns the index of the transition taken among the
+    // node's transitions, or -1 at the end.
+    int interpret(Stack *stack, piet_ctx *ctx, int node) const;
+    void requestCompile(int region);
+    void compileRegions();
+};
+
+#endif // TIERED_PROGRAM_H
@@ -0,0 +1,15 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <string>
+#include "Driver.h"
+
+// Watch a program file: every time it changes, recompile it incrementally (see
+// IncrementalProgram) and run it again in a child process, killing the run of the previous
+// version if it is still going. The program reads inputFile, or stdin if inputFile is empty.
+// Status lines go to stderr, the program's output to stdout. Returns only if the JIT cannot be
+// created (with 1); otherwise it runs until interrupted.
+int runWatch(const std::string &programFile, const std::string &inputFile,
+             const CompileOptions &options);
+
+#endif // WATCH_H
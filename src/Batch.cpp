@@ -0,0 +1,211 @@
+#include "Batch.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <set>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+// Helper: whether a file found in a batch directory is the output of an earlier batch rather
+// than an input. IR, objects and run outputs never are inputs; graph and codel files are taken
+// as outputs when another file in the directory has the same stem (their source).
+static bool isBatchOutput(const fs::path &path, const std::set<std::string> &sourceStems) {
+    std::string ext = path.extension().string();
+    if (ext == ".ll" || ext == ".o" || ext == ".out")
+        return true;
+    if (ext == ".pgraph" || ext == ".pcodels")
+        return sourceStems.count(path.stem().string()) > 0;
+    return false;
+}
+
+bool collectBatchInputs(const std::string &source, std::vector<std::string> &inputs) {
+    std::error_code ec;
+    if (fs::is_directory(source, ec)) {
+        std::vector<fs::path> files;
+        std::set<std::string> sourceStems;
+        for (const auto &entry : fs::directory_iterator(source, ec)) {
+            if (!entry.is_regular_file(ec))
+                continue;
+            files.push_back(entry.path());
+            std::string ext = entry.path().extension().string();
+            if (ext != ".pgraph" && ext != ".pcodels")
+                sourceStems.insert(entry.path().stem().string());
+        }
+        if (ec) {
+            consoleErr() << "Error: cannot read directory " << source << ": " << ec.message() << "\n";
+            return false;
+        }
+        for (const auto &file : files) {
+            if (!isBatchOutput(file, sourceStems))
+                inputs.push_back(file.string());
+        }
+        std::sort(inputs.begin(), inputs.end());
+        return true;
+    }
+    std::ifstream list(source);
+    if (!list) {
+        consoleErr() << "Error: Cannot open file " << source << "\n";
+        return false;
+    }
+    std::string line;
+    while (std::getline(list, line)) {
+        // Trim surrounding whitespace (including a trailing '\r').
+        size_t begin = line.find_first_not_of(" \t\r");
+        if (begin == std::string::npos)
+            continue;
+        size_t end = line.find_last_not_of(" \t\r");
+        inputs.push_back(line.substr(begin, end - begin + 1));
+    }
+    return true;
+}
+
+// Helper: the output path of one batch input.
+static std::string batchOutputPath(const std::string &input, const std::string &outDir,
+                                   const char *extension) {
+    fs::path name = fs::path(input).filename().replace_extension(extension);
+    fs::path dir = outDir.empty() ? fs::path(input).parent_path() : fs::path(outDir);
+    return (dir / name).string();
+}
+
+// Helper: create the output directory and resolve the output path of every input up front;
+// two inputs writing a file of the same path (filesOf gives the files written for an output
+// path) are both failures rather than silently overwriting each other. Returns false if the
+// directory cannot be created.
+static bool prepareOutputs(const std::vector<std::string> &inputs, const std::string &outDir,
+                           const char *extension,
+                           const std::function<std::vector<std::string>(const std::string&)> &filesOf,
+                           std::vector<std::string> &outputs, std::vector<std::string> &failures) {
+    if (!outDir.empty()) {
+        std::error_code ec;
+        fs::create_directories(outDir, ec);
+        if (ec) {
+            consoleErr() << "Error: cannot create output directory " << outDir << ": "
+                      << ec.message() << "\n";
+            return false;
+        }
+    }
+    outputs.assign(inputs.size(), std::string());
+    failures.assign(inputs.size(), std::string());
+    std::map<std::string, size_t> owners;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        outputs[i] = batchOutputPath(inputs[i], outDir, extension);
+        for (const std::string &file : filesOf(outputs[i])) {
+            auto inserted = owners.emplace(file, i);
+            if (!inserted.second) {
+                failures[i] = "output path collides with " + inputs[inserted.first->second];
+                failures[inserted.first->second] = "output path collides with " + inputs[i];
+            }
+        }
+    }
+    return true;
+}
+
+// Helper: the number of worker threads for n inputs.
+static int workerCount(int jobs, size_t n) {
+    if (jobs <= 0)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    return std::min<size_t>(jobs, std::max<size_t>(n, 1));
+}
+
+// Helper: run worker on `jobs` threads (the calling thread being one of them).
+static void runWorkers(int jobs, const std::function<void()> &worker) {
+    std::vector<std::thread> pool;
+    for (int t = 1; t < jobs; ++t)
+        pool.emplace_back(worker);
+    worker();
+    for (auto &thread : pool)
+        thread.join();
+}
+
+// Helper: print the failure summary. Returns the number of failed inputs.
+static int printSummary(const char *what, const std::vector<std::string> &inputs,
+                        const std::vector<std::string> &failures, int jobs) {
+    int failed = 0;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        if (failures[i].empty())
+            continue;
+        if (failed++ == 0)
+            consoleErr() << "Failed inputs:\n";
+        consoleErr() << "  " << inputs[i] << ": " << failures[i] << "\n";
+    }
+    consoleOut() << what << ": " << inputs.size() << " inputs, " << inputs.size() - failed
+              << " succeeded, " << failed << " failed (" << jobs << " jobs)\n";
+    return failed;
+}
+
+int runBatch(const std::vector<std::string> &inputs, const std::string &outDir, int jobs,
+             const CompileOptions &options) {
+    std::vector<std::string> outputs, failures;
+    auto filesOf = [&](const std::string &output) { return outputPaths(output, options); };
+    if (!prepareOutputs(inputs, outDir, outputExtension(options.emit), filesOf, outputs, failures))
+        return inputs.size();
+    jobs = workerCount(jobs, inputs.size());
+
+    // Workers pull the next input index from a shared counter. Each one owns an LLVMContext,
+    // since contexts must not be shared between threads.
+    std::atomic<size_t> next{0};
+    // The first error of each input becomes its failure message; other diagnostics are dropped.
+    auto worker = [&]() {
+        llvm::LLVMContext context;
+        for (size_t i = next++; i < inputs.size(); i = next++) {
+            if (!failures[i].empty())
+                continue;
+            std::string error;
+            CompileOptions inputOptions = options;
+            inputOptions.diagnostics = [&error](DiagnosticSeverity severity, const std::string &message) {
+                if (severity == DiagnosticSeverity::Error && error.empty())
+                    error = message;
+            };
+            if (!compileFile(inputs[i], outputs[i], inputOptions, context))
+                failures[i] = error.empty() ? "compilation failed" : error;
+        }
+    };
+    runWorkers(jobs, worker);
+    return printSummary("Batch", inputs, failures, jobs);
+}
+
+int runInputs(const std::function<int(piet_ctx*)> &run, const std::vector<std::string> &inputs,
+              const std::string &outDir, int jobs) {
+    std::vector<std::string> outputs, failures;
+    auto filesOf = [](const std::string &output) { return std::vector<std::string>{ output }; };
+    if (!prepareOutputs(inputs, outDir, "out", filesOf, outputs, failures))
+        return inputs.size();
+    jobs = workerCount(jobs, inputs.size());
+
+    // Workers pull the next input index from a shared counter. Each one reuses a single context
+    // (and with it the stack and output buffer) for all of its runs.
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        piet_ctx *ctx = pietCreateContext(nullptr, 0);
+        for (size_t i = next++; i < inputs.size(); i = next++) {
+            if (!failures[i].empty())
+                continue;
+            auto input = llvm::MemoryBuffer::getFile(inputs[i], /*IsText=*/false,
+                                                     /*RequiresNullTerminator=*/false);
+            if (!input) {
+                failures[i] = "cannot read input: " + input.getError().message();
+                continue;
+            }
+            ctx->input = (*input)->getBufferStart();
+            ctx->inputSize = (*input)->getBufferSize();
+            pietResetContext(ctx);
+            int status = run(ctx);
+            std::ofstream out(outputs[i], std::ios::binary);
+            if (!out.write(ctx->output, ctx->outputSize))
+                failures[i] = "cannot write " + outputs[i];
+            else if (status == PIET_OUT_OF_FUEL)
+                failures[i] = "ran out of fuel (partial output written)";
+        }
+        ctx->input = nullptr;
+        pietDestroyContext(ctx);
+    };
+    runWorkers(jobs, worker);
+    return printSummary("Run", inputs, failures, jobs);
+}
@@ -0,0 +1,100 @@
+#include "CompileCache.h"
+#include "Diagnostics.h"
+#include "PietRuntime.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/SHA1.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <system_error>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// Bump this whenever the code generator changes, so that stale entries are never reused.
+static const char *kCacheFormatVersion = "pietric-cache-3";
+
+// Helper: the layout of the structures generated code accesses directly. It is part of every
+// key, so an entry compiled against another runtime ABI is never linked even if a change
+// forgot to bump kCacheFormatVersion.
+static std::string runtimeLayout() {
+    auto field = [](size_t offset) { return std::to_string(offset) + ","; };
+    return "Stack:" + field(sizeof(Stack)) + field(offsetof(Stack, data)) +
+           field(offsetof(Stack, size)) + field(offsetof(Stack, capacity)) +
+           field(offsetof(Stack, guarded)) + "piet_ctx:" + field(sizeof(piet_ctx)) +
+           field(offsetof(piet_ctx, stack)) + field(offsetof(piet_ctx, input)) +
+           field(offsetof(piet_ctx, inputSize)) + field(offsetof(piet_ctx, inputPos)) +
+           field(offsetof(piet_ctx, output)) + field(offsetof(piet_ctx, outputSize)) +
+           field(offsetof(piet_ctx, outputCapacity)) + field(offsetof(piet_ctx, stdio)) +
+           field(offsetof(piet_ctx, fuel)) + field(offsetof(piet_ctx, in)) +
+           field(offsetof(piet_ctx, out));
+}
+
+CompileCache::CompileCache(const std::string &directory) : directory(directory) {
+}
+
+// Helper: append a 32-bit value in little-endian order.
+static void appendU32(std::vector<uint8_t> &out, uint32_t value) {
+    for (int i = 0; i < 4; ++i)
+        out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+std::string CompileCache::computeKey(const std::vector<std::vector<PietColor>> &grid,
+                                     const std::string &options) {
+    // Serialize the version, the options and the grid (row lengths included, since text
+    // inputs may be ragged), then hash the whole buffer.
+    static const std::string version = std::string(kCacheFormatVersion) + ";" + runtimeLayout();
+    std::vector<uint8_t> buffer(version.begin(), version.end());
+    buffer.push_back(0);
+    buffer.insert(buffer.end(), options.begin(), options.end());
+    buffer.push_back(0);
+    appendU32(buffer, grid.size());
+    for (const auto &row : grid) {
+        appendU32(buffer, row.size());
+        for (PietColor color : row)
+            buffer.push_back(static_cast<uint8_t>(color));
+    }
+    return llvm::toHex(llvm::SHA1::hash(buffer), /*LowerCase=*/true);
+}
+
+std::string CompileCache::entryPath(const std::string &key, const std::string &artifact) const {
+    // Fan entries out over 256 subdirectories to keep directory sizes small.
+    return (fs::path(directory) / key.substr(0, 2) / (key.substr(2) + "." + artifact)).string();
+}
+
+bool CompileCache::lookup(const std::string &key, const std::string &artifact,
+                          const std::string &outputPath) const {
+    std::error_code ec;
+    std::string entry = entryPath(key, artifact);
+    if (!fs::is_regular_file(entry, ec))
+        return false;
+    fs::copy_file(entry, outputPath, fs::copy_options::overwrite_existing, ec);
+    return !ec;
+}
+
+bool CompileCache::store(const std::string &key, const std::string &artifact,
+                         const std::string &path) const {
+    static std::atomic<unsigned> counter{0};
+    std::error_code ec;
+    fs::path entry = entryPath(key, artifact);
+    fs::create_directories(entry.parent_path(), ec);
+    if (ec) {
+        reportWarning("cannot create cache directory " + entry.parent_path().string() + ": " +
+                      ec.message());
+        return false;
+    }
+    // Copy to a unique temporary name first and rename it into place, so that concurrent
+    // compilers never observe a partially written entry.
+    fs::path tmp = entry;
+    tmp += ".tmp." + std::to_string(getpid()) + "." + std::to_string(counter++);
+    fs::copy_file(path, tmp, fs::copy_options::overwrite_existing, ec);
+    if (!ec)
+        fs::rename(tmp, entry, ec);
+    if (ec) {
+        fs::remove(tmp, ec);
+        reportWarning("cannot store cache entry " + entry.string());
+        return false;
+    }
+    return true;
+}
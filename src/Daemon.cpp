@@ -0,0 +1,324 @@
+#include "Daemon.h"
+#include "DaemonProtocol.h"
+#include "Diagnostics.h"
+#include "ObjectEmitter.h"
+#include "ProgramCache.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <poll.h>
+#include <sched.h>
+#include <streambuf>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+// The client descriptors (stdout, stderr) of the request the current thread serves; -1 on
+// threads that serve none.
+static thread_local int requestFds[2] = { -1, -1 };
+
+// An unbuffered stream buffer writing to one of a client's descriptors. If the client closed
+// the stream, or its disk is full, the rest of the output is dropped but still reported as
+// written, so that the stream never enters a failed state.
+class ClientStreamBuf : public std::streambuf {
+public:
+    explicit ClientStreamBuf(int fd) : fd(fd) {}
+protected:
+    int overflow(int ch) override {
+        if (ch == traits_type::eof())
+            return traits_type::not_eof(ch);
+        char byte = static_cast<char>(ch);
+        xsputn(&byte, 1);
+        return ch;
+    }
+    std::streamsize xsputn(const char *data, std::streamsize size) override {
+        std::streamsize done = 0;
+        while (fd >= 0 && done < size) {
+            ssize_t written = write(fd, data + done, size - done);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                fd = -1;
+            else
+                done += written;
+        }
+        return size;
+    }
+private:
+    int fd;
+};
+
+// The connection of the request the current thread serves; -1 on threads that serve none.
+static thread_local int requestConnection = -1;
+
+// Helper: close every descriptor of the process but the standard streams and those in keep.
+static void closeOtherDescriptors(std::vector<int> keep) {
+    keep.push_back(STDERR_FILENO);
+    std::sort(keep.begin(), keep.end());
+    unsigned first = 0;
+    for (int fd : keep) {
+        if (fd < 0)
+            continue;
+        if (static_cast<unsigned>(fd) > first)
+            close_range(first, fd - 1, 0);
+        first = fd + 1;
+    }
+    close_range(first, ~0u, 0);
+}
+
+// Helper: wait for the child running a request to exit, and kill it if the client hangs up
+// first (setting cancelled). Returns the child's wait status.
+static int waitForRun(pid_t child, bool &cancelled) {
+    // A pidfd becomes readable when the child exits; without one, look again every 50 ms.
+    int pidfd = -1;
+#ifdef SYS_pidfd_open
+    pidfd = syscall(SYS_pidfd_open, child, 0);
+#endif
+    int wstatus = 0;
+    while (true) {
+        pid_t done = waitpid(child, &wstatus, WNOHANG);
+        if (done == child || (done < 0 && errno != EINTR))
+            break;
+        struct pollfd fds[2] = { { requestConnection, POLLRDHUP, 0 }, { pidfd, POLLIN, 0 } };
+        int ready = poll(fds, 2, pidfd >= 0 ? -1 : 50);
+        if (ready > 0 && (fds[0].revents & (POLLRDHUP | POLLHUP | POLLERR))) {
+            kill(child, SIGKILL);
+            cancelled = true;
+            while (waitpid(child, &wstatus, 0) < 0 && errno == EINTR) {
+            }
+            break;
+        }
+    }
+    if (pidfd >= 0)
+        close(pidfd);
+    return wstatus;
+}
+
+int runInChild(const CommandLine &command, const std::function<int()> &body) {
+    pid_t child = fork();
+    if (child < 0) {
+        consoleErr() << "Error: cannot start a process for the run: " << std::strerror(errno)
+                     << "\n";
+        return 1;
+    }
+    if (child == 0) {
+        // Other clients must see their streams end when their own requests do, not when this
+        // run does.
+        closeOtherDescriptors({ fileno(command.in), fileno(command.out), requestFds[0],
+                                requestFds[1] });
+        // Threads the run starts have no console of their own; give them the client's.
+        dup2(requestFds[0], STDOUT_FILENO);
+        dup2(requestFds[1], STDERR_FILENO);
+        int status = 1;
+        try {
+            status = body();
+        } catch (const std::exception &e) {
+            consoleErr() << "Error: " << e.what() << "\n";
+        }
+        std::fflush(command.out);
+        _exit(status);
+    }
+    bool cancelled = false;
+    int wstatus = waitForRun(child, cancelled);
+    if (cancelled)
+        return 128 + SIGKILL;
+    if (WIFEXITED(wstatus))
+        return WEXITSTATUS(wstatus);
+    if (WIFSIGNALED(wstatus)) {
+        int sig = WTERMSIG(wstatus);
+        consoleErr() << "Error: the program was stopped by signal " << sig << " (" << strsignal(sig)
+                  << ")\n";
+        return 128 + sig;
+    }
+    return 1;
+}
+
+// Helper: run one client's request on the current worker thread.
+static void serveRequest(int connection, const CommandHandler &handler, ProgramCache &cache,
+                         bool ownWorkingDirectory) {
+    DaemonRequest request;
+    int fds[3];
+    if (!receiveDaemonRequest(connection, request, fds)) {
+        close(connection);
+        return;
+    }
+    requestFds[0] = fds[1];
+    requestFds[1] = fds[2];
+    requestConnection = connection;
+    int status = 1;
+    {
+        // The command's console: streams of its own, so that it shares no state with other
+        // requests.
+        ClientStreamBuf outBuffer(fds[1]), errBuffer(fds[2]);
+        std::ostream out(&outBuffer), err(&errBuffer);
+        ConsoleScope console(out, err);
+        if (!ownWorkingDirectory) {
+            err << "Error: the daemon cannot give requests a working directory of their own\n";
+        } else if (chdir(request.cwd.c_str()) != 0) {
+            err << "Error: cannot change to directory " << request.cwd << ": "
+                << std::strerror(errno) << "\n";
+        } else {
+            // The program streams get descriptors of their own, since closing them must not
+            // close the ones the console writes to.
+            CommandLine command;
+            command.args = request.args;
+            command.cacheDir = request.cacheDir;
+            command.in = fdopen(dup(fds[0]), "r");
+            command.out = fdopen(dup(fds[1]), "w");
+            command.programCache = &cache;
+            command.inDaemon = true;
+            if (!command.in || !command.out) {
+                err << "Error: cannot open the client's streams: " << std::strerror(errno) << "\n";
+            } else {
+                // A failing command must not take the daemon, or the other requests, with it.
+                try {
+                    status = handler(command);
+                } catch (const std::exception &e) {
+                    err << "Error: " << e.what() << "\n";
+                    status = 1;
+                }
+            }
+            if (command.in)
+                std::fclose(command.in);
+            if (command.out)
+                std::fclose(command.out);
+        }
+    }
+    requestFds[0] = requestFds[1] = -1;
+    requestConnection = -1;
+    for (int fd : fds)
+        close(fd);
+    sendDaemonStatus(connection, status);
+    close(connection);
+}
+
+// Helper: make sure the directory of the socket exists and only its owner, the current user, can
+// add or replace files in it.
+static bool preparePrivateDirectory(const std::string &socketPath) {
+    size_t slash = socketPath.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : socketPath.substr(0, slash);
+    if (directory.empty())
+        directory = "/";
+    if (mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST) {
+        std::cerr << "Error: cannot create directory " << directory << ": " << std::strerror(errno)
+                  << "\n";
+        return false;
+    }
+    struct stat info;
+    if (lstat(directory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode) ||
+        info.st_uid != getuid() || (info.st_mode & (S_IWGRP | S_IWOTH))) {
+        std::cerr << "Error: the daemon socket's directory " << directory
+                  << " must be a directory owned by the current user and writable by no one else\n";
+        return false;
+    }
+    return true;
+}
+
+int runDaemon(const std::string &socketPath, int jobs, const CommandHandler &handler) {
+    // A client that goes away must not take the daemon with it.
+    std::signal(SIGPIPE, SIG_IGN);
+
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Error: daemon socket path too long: " << socketPath << "\n";
+        return 1;
+    }
+    std::strcpy(address.sun_path, socketPath.c_str());
+    if (!preparePrivateDirectory(socketPath))
+        return 1;
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        std::cerr << "Error: cannot create a socket: " << std::strerror(errno) << "\n";
+        return 1;
+    }
+    // A socket file nobody listens on is left over from a daemon that was killed.
+    if (connect(listener, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == 0) {
+        std::cerr << "Error: a daemon is already listening on " << socketPath << "\n";
+        close(listener);
+        return 1;
+    }
+    unlink(socketPath.c_str());
+    if (bind(listener, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0 ||
+        chmod(socketPath.c_str(), 0600) != 0 || listen(listener, SOMAXCONN) != 0) {
+        std::cerr << "Error: cannot listen on " << socketPath << ": " << std::strerror(errno) << "\n";
+        close(listener);
+        return 1;
+    }
+
+    // Everything a command would otherwise set up again in each process.
+    initializeHostTarget();
+    ProgramCache cache;
+
+    if (jobs <= 0)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    std::mutex queueMutex;
+    std::condition_variable queueReady;
+    std::deque<int> queue;      // Accepted connections.
+    bool stopping = false;
+    auto worker = [&]() {
+        // Give the thread (and the threads its commands start) a working directory of its own.
+        bool ownWorkingDirectory = unshare(CLONE_FS) == 0;
+        while (true) {
+            int connection;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueReady.wait(lock, [&]() { return stopping || !queue.empty(); });
+                if (queue.empty())
+                    return;
+                connection = queue.front();
+                queue.pop_front();
+            }
+            serveRequest(connection, handler, cache, ownWorkingDirectory);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int t = 0; t < jobs; ++t)
+        pool.emplace_back(worker);
+    std::cerr << "[daemon] listening on " << socketPath << " (" << jobs << " workers)\n";
+
+    while (true) {
+        int connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // Out of descriptors or memory: wait for running requests to release some.
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            std::cerr << "Error: cannot accept connections: " << std::strerror(errno) << "\n";
+            break;
+        }
+        if (!peerIsCurrentUser(connection)) {
+            close(connection);
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            queue.push_back(connection);
+        }
+        queueReady.notify_one();
+    }
+
+    // Finish the requests already accepted.
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueReady.notify_all();
+    for (auto &thread : pool)
+        thread.join();
+    close(listener);
+    return 1;
+}
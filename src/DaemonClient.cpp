@@ -0,0 +1,55 @@
+// pietric-client: run a Pietric command line in the daemon (Pietric --daemon) instead of a new
+// compiler process. It takes the same arguments as Pietric, and hands the daemon its working
+// directory, PIETRIC_CACHE_DIR and standard streams; its exit status is the command's.
+#include "DaemonProtocol.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+int main(int argc, char **argv) {
+    std::signal(SIGPIPE, SIG_IGN);
+    std::string path = daemonSocketPath();
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Error: daemon socket path too long: " << path << "\n";
+        return 1;
+    }
+    std::strcpy(address.sun_path, path.c_str());
+
+    DaemonRequest request;
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        std::cerr << "Error: cannot get the working directory: " << std::strerror(errno) << "\n";
+        return 1;
+    }
+    request.cwd = cwd;
+    if (const char *env = std::getenv("PIETRIC_CACHE_DIR"))
+        request.cacheDir = env;
+    request.args.assign(argv + 1, argv + argc);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0) {
+        std::cerr << "Error: cannot connect to the daemon at " << path << ": " << std::strerror(errno)
+                  << " (start one with Pietric --daemon)\n";
+        return 1;
+    }
+    if (!peerIsCurrentUser(fd)) {
+        std::cerr << "Error: the daemon at " << path << " is not running as the current user\n";
+        return 1;
+    }
+    const int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    int status;
+    if (!sendDaemonRequest(fd, request, fds) || !receiveDaemonStatus(fd, status)) {
+        std::cerr << "Error: the daemon at " << path << " closed the connection\n";
+        return 1;
+    }
+    close(fd);
+    return status;
+}
@@ -0,0 +1,179 @@
+#include "DaemonProtocol.h"
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Requests larger than this are rejected rather than buffered.
+static const uint32_t kMaxRequestSize = 16 << 20;
+
+std::string daemonSocketPath() {
+    if (const char *env = std::getenv("PIETRIC_DAEMON_SOCKET"))
+        return env;
+    const char *runtimeDir = std::getenv("XDG_RUNTIME_DIR");
+    if (runtimeDir && *runtimeDir)
+        return std::string(runtimeDir) + "/pietric.sock";
+    return "/tmp/pietric-" + std::to_string(getuid()) + "/daemon.sock";
+}
+
+bool peerIsCurrentUser(int socket) {
+    struct ucred credentials;
+    socklen_t size = sizeof(credentials);
+    if (getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &credentials, &size) != 0)
+        return false;
+    return credentials.uid == getuid();
+}
+
+// Helper: write all of a buffer.
+static bool writeAll(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+// Helper: read exactly size bytes. Returns false at the end of the stream or on error.
+static bool readAll(int fd, char *data, size_t size) {
+    while (size > 0) {
+        ssize_t got = read(fd, data, size);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        data += got;
+        size -= got;
+    }
+    return true;
+}
+
+// Helper: append a 32-bit integer.
+static void appendU32(std::string &buffer, uint32_t value) {
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Helper: append a string and its length.
+static void appendString(std::string &buffer, const std::string &value) {
+    appendU32(buffer, value.size());
+    buffer += value;
+}
+
+bool sendDaemonRequest(int socket, const DaemonRequest &request, const int fds[3]) {
+    std::string payload;
+    appendString(payload, request.cwd);
+    appendString(payload, request.cacheDir);
+    for (const auto &arg : request.args)
+        appendString(payload, arg);
+    uint32_t size = payload.size();
+
+    // The descriptors travel with the length word.
+    struct iovec iov = { &size, sizeof(size) };
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    std::memset(control, 0, sizeof(control));
+    struct msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    std::memcpy(CMSG_DATA(header), fds, 3 * sizeof(int));
+    ssize_t sent;
+    do {
+        sent = sendmsg(socket, &message, 0);
+    } while (sent < 0 && errno == EINTR);
+    if (sent != sizeof(size))
+        return false;
+    return writeAll(socket, payload.data(), payload.size());
+}
+
+bool receiveDaemonRequest(int socket, DaemonRequest &request, int fds[3]) {
+    uint32_t size = 0;
+    struct iovec iov = { &size, sizeof(size) };
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t got;
+    do {
+        got = recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+    } while (got < 0 && errno == EINTR);
+    if (got <= 0)
+        return false;
+
+    // Take ownership of whatever descriptors arrived before validating anything else.
+    int received = 0;
+    for (struct cmsghdr *header = CMSG_FIRSTHDR(&message); header;
+         header = CMSG_NXTHDR(&message, header)) {
+        if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+            continue;
+        int count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < count; ++i) {
+            int fd;
+            std::memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+            if (received < 3)
+                fds[received++] = fd;
+            else
+                close(fd);
+        }
+    }
+    auto fail = [&]() {
+        for (int i = 0; i < received; ++i)
+            close(fds[i]);
+        return false;
+    };
+    if (received != 3 || (message.msg_flags & MSG_CTRUNC))
+        return fail();
+    if (got < static_cast<ssize_t>(sizeof(size)) &&
+        !readAll(socket, reinterpret_cast<char*>(&size) + got, sizeof(size) - got))
+        return fail();
+    if (size > kMaxRequestSize)
+        return fail();
+    std::string payload(size, '\0');
+    if (!readAll(socket, &payload[0], size))
+        return fail();
+
+    std::vector<std::string> strings;
+    size_t pos = 0;
+    while (pos < payload.size()) {
+        uint32_t length;
+        if (payload.size() - pos < sizeof(length))
+            return fail();
+        std::memcpy(&length, payload.data() + pos, sizeof(length));
+        pos += sizeof(length);
+        if (payload.size() - pos < length)
+            return fail();
+        strings.push_back(payload.substr(pos, length));
+        pos += length;
+    }
+    if (strings.size() < 2)
+        return fail();
+    request.cwd = strings[0];
+    request.cacheDir = strings[1];
+    request.args.assign(strings.begin() + 2, strings.end());
+    return true;
+}
+
+bool sendDaemonStatus(int socket, int status) {
+    int32_t value = status;
+    return writeAll(socket, reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+bool receiveDaemonStatus(int socket, int &status) {
+    int32_t value;
+    if (!readAll(socket, reinterpret_cast<char*>(&value), sizeof(value)))
+        return false;
+    status = value;
+    return true;
+}
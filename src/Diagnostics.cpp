@@ -0,0 +1,63 @@
+#include "Diagnostics.h"
+#include <iostream>
+#include <utility>
+
+// The handler of the current thread (empty: print to the console).
+static thread_local DiagnosticHandler currentHandler;
+
+// The console of the current thread (null: std::cout and std::cerr).
+static thread_local std::ostream *currentOut = nullptr;
+static thread_local std::ostream *currentErr = nullptr;
+
+std::ostream &consoleOut() {
+    return currentOut ? *currentOut : std::cout;
+}
+
+std::ostream &consoleErr() {
+    return currentErr ? *currentErr : std::cerr;
+}
+
+ConsoleScope::ConsoleScope(std::ostream &out, std::ostream &err)
+    : previousOut(currentOut), previousErr(currentErr) {
+    currentOut = &out;
+    currentErr = &err;
+}
+
+ConsoleScope::~ConsoleScope() {
+    currentOut = previousOut;
+    currentErr = previousErr;
+}
+
+DiagnosticScope::DiagnosticScope(DiagnosticHandler handler)
+    : previous(std::move(currentHandler)) {
+    currentHandler = std::move(handler);
+}
+
+DiagnosticScope::~DiagnosticScope() {
+    currentHandler = std::move(previous);
+}
+
+// Helper: deliver one diagnostic.
+static void report(DiagnosticSeverity severity, const std::string &message) {
+    if (currentHandler) {
+        currentHandler(severity, message);
+        return;
+    }
+    switch (severity) {
+        case DiagnosticSeverity::Note:    consoleOut() << message << "\n"; break;
+        case DiagnosticSeverity::Warning: consoleErr() << "Warning: " << message << "\n"; break;
+        case DiagnosticSeverity::Error:   consoleErr() << "Error: " << message << "\n"; break;
+    }
+}
+
+void reportError(const std::string &message) {
+    report(DiagnosticSeverity::Error, message);
+}
+
+void reportWarning(const std::string &message) {
+    report(DiagnosticSeverity::Warning, message);
+}
+
+void reportNote(const std::string &message) {
+    report(DiagnosticSeverity::Note, message);
+}
@@ -0,0 +1,293 @@
+#include "Driver.h"
+#include "Parser.h"
+#include "Graph.h"
+#include "IRBuilder.h"
+#include "CompileCache.h"
+#include "ObjectEmitter.h"
+#include "PartialEval.h"
+#include "ProgramCache.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include <memory>
+
+std::string CompileOptions::fingerprint() const {
+    // The caches and the diagnostic handler do not affect the output.
+    return std::string("emit=") + outputExtension(emit) +
+           ";partition=" + std::to_string(partitionThreshold) +
+           ";threads=" + std::to_string(emit == EmitKind::Object ? codegenThreads : 1) +
+           ";minimize=" + (minimize ? "1" : "0") +
+           ";trace=" + (trace ? "1" : "0") +
+           ";guard=" + (guardedStack ? "1" : "0") +
+           ";eval=" + std::to_string(trace || fuel > 0 ? 0 : evalSteps) +
+           ";fuel=" + std::to_string(fuel);
+}
+
+const char *outputExtension(EmitKind emit) {
+    switch (emit) {
+        case EmitKind::Object: return "o";
+        case EmitKind::Graph:  return "pgraph";
+        case EmitKind::Codels: return "pcodels";
+        default:               return "ll";
+    }
+}
+
+std::vector<std::string> outputPaths(const std::string &outputFile, const CompileOptions &options) {
+    if (options.emit != EmitKind::Object || options.codegenThreads <= 1)
+        return { outputFile };
+    std::string stem = outputFile, ext;
+    size_t dot = outputFile.find_last_of('.');
+    size_t slash = outputFile.find_last_of('/');
+    if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+        stem = outputFile.substr(0, dot);
+        ext = outputFile.substr(dot);
+    }
+    std::vector<std::string> paths;
+    for (int i = 0; i < options.codegenThreads; ++i)
+        paths.push_back(stem + "." + std::to_string(i) + ext);
+    return paths;
+}
+
+// Helper: the cache artifact name of the i-th of n outputs.
+static std::string artifactName(const CompileOptions &options, size_t i, size_t n) {
+    std::string ext = outputExtension(options.emit);
+    return n == 1 ? ext : std::to_string(i) + "." + ext;
+}
+
+// Helper: build the graph of a codel grid into graph, as the options ask for it.
+static void buildGraphOfGrid(const std::vector<std::vector<PietColor>> &grid,
+                             const CompileOptions &options, Graph &graph) {
+    bool minimize = options.minimize && !options.trace;
+    if (options.programCache) {
+        graph = *options.programCache->graph(grid, minimize);
+        return;
+    }
+    graph.buildGraph(grid);
+    if (minimize)
+        graph.minimize();
+}
+
+// Helper: the graph of a codel grid, as the options ask for it; shared with the program
+// cache, if there is one.
+static std::shared_ptr<const Graph> graphOfGrid(const std::vector<std::vector<PietColor>> &grid,
+                                                const CompileOptions &options) {
+    if (options.programCache)
+        return options.programCache->graph(grid, options.minimize && !options.trace);
+    auto graph = std::make_shared<Graph>();
+    buildGraphOfGrid(grid, options, *graph);
+    return graph;
+}
+
+// Helper: parse a program file with parser, or take its grid from the program cache (held by
+// cached). Returns null, after reporting why, on failure.
+static const std::vector<std::vector<PietColor>> *
+parseProgramFile(const std::string &inputFile, const CompileOptions &options, Parser &parser,
+                 std::shared_ptr<const std::vector<std::vector<PietColor>>> &cached) {
+    if (options.programCache) {
+        cached = options.programCache->grid(inputFile);
+        return cached.get();
+    }
+    if (!parser.parseFile(inputFile)) {
+        reportError("Failed to parse the input file.");
+        return nullptr;
+    }
+    return &parser.getGrid();
+}
+
+std::unique_ptr<llvm::Module> generateModule(const Graph &graph, const CompileOptions &options,
+                                             llvm::LLVMContext &context) {
+    IRGenerator irgen(context);
+    irgen.setPartitionThreshold(options.partitionThreshold);
+    irgen.setTrace(options.trace);
+    irgen.setGuardedStack(options.guardedStack);
+    irgen.setFuel(options.fuel);
+
+    // Run the program up to its first input at compile time; the generated code starts from
+    // the state reached, with its output already produced. A fuel budget counts the loop
+    // iterations of the whole run, so it runs the program from the start.
+    if (options.evalSteps > 0 && !options.trace && options.fuel == 0) {
+        ProgramPrefix prefix = evaluatePrefix(graph, options.evalSteps);
+        if (prefix.steps > 0) {
+            irgen.setInitialState(prefix.stack, prefix.output);
+            return std::unique_ptr<llvm::Module>(irgen.generateModule(graph.subgraphFrom(prefix.node)));
+        }
+    }
+    return std::unique_ptr<llvm::Module>(irgen.generateModule(graph));
+}
+
+// Helper: generate the artifacts of a compilation from its execution graph, in memory.
+static bool generateOutputs(const Graph &graph, const CompileOptions &options,
+                            llvm::LLVMContext &context, std::vector<std::string> &outputs) {
+    if (options.emit == EmitKind::Graph) {
+        outputs.resize(1);
+        graph.serialize(outputs[0]);
+        return true;
+    }
+
+    // Generate LLVM IR.
+    std::unique_ptr<llvm::Module> module = generateModule(graph, options, context);
+    if (options.emit != EmitKind::Object) {
+        outputs.assign(1, std::string());
+        llvm::raw_string_ostream stream(outputs[0]);
+        module->print(stream, nullptr);
+        stream.flush();
+        return true;
+    }
+
+    // Generate the object file(s).
+    size_t parts = std::max(options.codegenThreads, 1);
+    std::vector<llvm::SmallVector<char, 0>> buffers(parts);
+    std::vector<std::unique_ptr<llvm::raw_svector_ostream>> streams;
+    std::vector<llvm::raw_pwrite_stream*> objectStreams;
+    for (auto &buffer : buffers) {
+        streams.push_back(std::make_unique<llvm::raw_svector_ostream>(buffer));
+        objectStreams.push_back(streams.back().get());
+    }
+    if (!emitObjects(*module, objectStreams))
+        return false;
+    outputs.clear();
+    for (const auto &buffer : buffers)
+        outputs.emplace_back(buffer.begin(), buffer.end());
+    return true;
+}
+
+// Helper: compile a parsed, non-empty codel grid into its artifacts.
+static bool compileParsedGrid(const std::vector<std::vector<PietColor>> &grid,
+                              const CompileOptions &options, llvm::LLVMContext &context,
+                              std::vector<std::string> &outputs) {
+    // Converting to the packed codel format needs nothing but the grid.
+    if (options.emit == EmitKind::Codels) {
+        outputs.resize(1);
+        Parser::writeCodels(grid, outputs[0]);
+        return true;
+    }
+    return generateOutputs(*graphOfGrid(grid, options), options, context, outputs);
+}
+
+// Helper: write artifacts to their files.
+static bool writeOutputs(const std::vector<std::string> &paths,
+                         const std::vector<std::string> &outputs) {
+    for (size_t i = 0; i < paths.size(); ++i) {
+        std::error_code EC;
+        llvm::raw_fd_ostream stream(paths[i], EC, llvm::sys::fs::OF_None);
+        if (EC) {
+            reportError("cannot open output file " + paths[i] + ": " + EC.message());
+            return false;
+        }
+        stream.write(outputs[i].data(), outputs[i].size());
+        stream.close();
+        if (stream.has_error()) {
+            reportError("cannot write output file " + paths[i] + ": " + stream.error().message());
+            stream.clear_error();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool loadProgramGraph(const std::string &inputFile, const CompileOptions &options, Graph &graph) {
+    std::unique_ptr<DiagnosticScope> scope;
+    if (options.diagnostics)
+        scope = std::make_unique<DiagnosticScope>(options.diagnostics);
+    if (Graph::isGraphFile(inputFile))
+        return graph.load(inputFile);
+    Parser parser;
+    std::shared_ptr<const std::vector<std::vector<PietColor>>> cached;
+    const auto *grid = parseProgramFile(inputFile, options, parser, cached);
+    if (!grid)
+        return false;
+    if (grid->empty()) {
+        reportError("empty input.");
+        return false;
+    }
+    buildGraphOfGrid(*grid, options, graph);
+    return true;
+}
+
+bool compileGrid(const std::vector<std::vector<PietColor>> &grid, const CompileOptions &options,
+                 llvm::LLVMContext &context, std::vector<std::string> &outputs) {
+    std::unique_ptr<DiagnosticScope> scope;
+    if (options.diagnostics)
+        scope = std::make_unique<DiagnosticScope>(options.diagnostics);
+    if (grid.empty()) {
+        reportError("empty input.");
+        return false;
+    }
+    return compileParsedGrid(grid, options, context, outputs);
+}
+
+bool compileBuffer(const void *data, size_t size, const CompileOptions &options,
+                   llvm::LLVMContext &context, std::vector<std::string> &outputs) {
+    std::unique_ptr<DiagnosticScope> scope;
+    if (options.diagnostics)
+        scope = std::make_unique<DiagnosticScope>(options.diagnostics);
+    Parser parser;
+    if (!parser.parseBuffer(data, size)) {
+        reportError("Failed to parse the input buffer.");
+        return false;
+    }
+    return compileGrid(parser.getGrid(), options, context, outputs);
+}
+
+bool compileFile(const std::string &inputFile, const std::string &outputFile,
+                 const CompileOptions &options, llvm::LLVMContext &context) {
+    std::unique_ptr<DiagnosticScope> scope;
+    if (options.diagnostics)
+        scope = std::make_unique<DiagnosticScope>(options.diagnostics);
+    std::vector<std::string> paths = outputPaths(outputFile, options);
+    std::vector<std::string> outputs;
+
+    // A graph file saved by an earlier compilation is mapped and used as it is.
+    if (Graph::isGraphFile(inputFile)) {
+        if (options.emit == EmitKind::Codels) {
+            reportError("a graph file does not contain the codel grid.");
+            return false;
+        }
+        Graph graph;
+        if (!graph.load(inputFile))
+            return false;
+        return generateOutputs(graph, options, context, outputs) && writeOutputs(paths, outputs);
+    }
+
+    // 1. Parse the Piet program (text, image or codel file).
+    Parser parser;
+    std::shared_ptr<const std::vector<std::vector<PietColor>>> cached;
+    const auto *parsed = parseProgramFile(inputFile, options, parser, cached);
+    if (!parsed)
+        return false;
+    const auto &grid = *parsed;
+    if (grid.empty()) {
+        reportError("empty input.");
+        return false;
+    }
+
+    // 2. Look the codel grid up in the compile cache; a hit skips everything below.
+    std::unique_ptr<CompileCache> cache;
+    std::string cacheKey;
+    if (!options.cacheDir.empty()) {
+        cache = std::make_unique<CompileCache>(options.cacheDir);
+        cacheKey = CompileCache::computeKey(grid, options.fingerprint());
+        bool hit = true;
+        for (size_t i = 0; i < paths.size() && hit; ++i)
+            hit = cache->lookup(cacheKey, artifactName(options, i, paths.size()), paths[i]);
+        if (hit) {
+            reportNote("Cache hit: " + cacheKey);
+            return true;
+        }
+    }
+
+    // 3. Build the execution graph and generate the outputs.
+    if (!compileParsedGrid(grid, options, context, outputs))
+        return false;
+
+    // 4. Write the outputs.
+    if (!writeOutputs(paths, outputs))
+        return false;
+
+    if (cache) {
+        for (size_t i = 0; i < paths.size(); ++i)
+            cache->store(cacheKey, artifactName(options, i, paths.size()), paths[i]);
+    }
+    return true;
+}
@@ -1,9 +1,22 @@
 #include "Graph.h"
-#include <queue>
-#include <iostream>
+#include "Diagnostics.h"
+#include "llvm/Support/FileSystem.h"
+#include <fstream>
 #include <algorithm>
+#include <cstring>
 #include <map>
 #include <set>
+#include <type_traits>
+
+// The node and edge arrays are written to and mapped from graph files as they are.
+static_assert(sizeof(GraphNode) == 16 && std::is_trivially_copyable<GraphNode>::value,
+              "GraphNode is part of the graph file format");
+static_assert(sizeof(GraphEdge) == 8 && std::is_trivially_copyable<GraphEdge>::value,
+              "GraphEdge is part of the graph file format");
+
+static const char kGraphFileMagic[8] = { 'P', 'I', 'E', 'T', 'G', 'R', 'F', 0 };
+// Bump this whenever GraphNode, GraphEdge or the header change.
+static const uint32_t kGraphFileVersion = 1;
 
 // Helper: returns true if (r, c) is within the grid bounds.
 static bool inBounds(int r, int c, int rows, int cols) {
@@ -13,45 +26,43 @@ static bool inBounds(int r, int c, int rows, int cols) {
 Graph::Graph() {
 }
 
-void Graph::computeBlocks(const std::vector<std::vector<PietColor>> &grid) {
+int Graph::labelBlock(int r, int c, const std::vector<std::vector<PietColor>> &grid) {
     int rows = grid.size();
-    if (rows == 0) return;
     int cols = grid[0].size();
-    std::vector<std::vector<bool>> visited(rows, std::vector<bool>(cols, false));
-    int blockId = 0;
+    int &label = labels[static_cast<size_t>(r) * cols + c];
+    if (label >= 0)
+        return label;
+
     const int dr[4] = { -1, 1, 0, 0 };
     const int dc[4] = { 0, 0, -1, 1 };
-
-    blocks.clear();
-    for (int r = 0; r < rows; ++r) {
-        for (int c = 0; c < cols; ++c) {
-            if (visited[r][c]) continue;
-            PietColor color = grid[r][c];
-            // Create a new block.
-            Block block;
-            block.id = blockId++;
-            block.color = color;
-            block.size = 0;
-            std::queue<std::pair<int,int>> q;
-            q.push({r, c});
-            visited[r][c] = true;
-            while (!q.empty()) {
-                auto [cr, cc] = q.front();
-                q.pop();
-                block.cells.push_back({cr, cc});
-                block.size++;
-                for (int i = 0; i < 4; ++i) {
-                    int nr = cr + dr[i], nc = cc + dc[i];
-                    if (inBounds(nr, nc, rows, cols) && !visited[nr][nc] &&
-                        grid[nr][nc] == color) {
-                        visited[nr][nc] = true;
-                        q.push({nr, nc});
-                    }
-                }
+    PietColor color = grid[r][c];
+    // Create a new block and flood-fill it, labeling its codels as they are found.
+    Block block;
+    block.id = blocks.size();
+    block.color = color;
+    block.size = 0;
+    block.origin = {r, c};
+    label = block.id;
+    std::vector<std::pair<int,int>> pending = { {r, c} };
+    while (!pending.empty()) {
+        auto [cr, cc] = pending.back();
+        pending.pop_back();
+        block.cells.push_back({cr, cc});
+        block.size++;
+        block.origin = std::min(block.origin, std::make_pair(cr, cc));
+        for (int i = 0; i < 4; ++i) {
+            int nr = cr + dr[i], nc = cc + dc[i];
+            if (!inBounds(nr, nc, rows, cols) || grid[nr][nc] != color)
+                continue;
+            int &neighbor = labels[static_cast<size_t>(nr) * cols + nc];
+            if (neighbor < 0) {
+                neighbor = block.id;
+                pending.push_back({nr, nc});
             }
-            blocks.push_back(block);
         }
     }
+    blocks.push_back(std::move(block));
+    return blocks.back().id;
 }
 
 Command Graph::getCommand(PietColor from, PietColor to) {
@@ -182,15 +193,11 @@ std::pair<int,int> Graph::getNextCodel(const std::pair<int,int>& coord, Directio
 }
 
 // --- Helper: findBlockId ---
-// Look through the computed blocks to find one that contains (r,c).
+// Look up the label of (r,c) in the codel map.
 int Graph::findBlockId(int r, int c) const {
-    for (const auto &b : blocks) {
-        for (const auto &cell : b.cells) {
-            if (cell.first == r && cell.second == c)
-                return b.id;
-        }
-    }
-    return -1;
+    if (labels.empty() || r < 0 || c < 0 || r >= labelRows || c >= labelCols)
+        return -1;
+    return labels[static_cast<size_t>(r) * labelCols + c];
 }
 
 // --- Helper: rotateDP ---
@@ -207,196 +214,663 @@ CodelChooser Graph::toggleCC(CodelChooser cc) {
     return (cc == CodelChooser::Left ? CodelChooser::Right : CodelChooser::Left);
 }
 
-// --- BuildGraph ---
-// Here we simulate Piet movement from one block to the next following the DP/CC rules.
-// We use a worklist to traverse reachable states. A state is a triple: (blockId, dp, cc).
-void Graph::buildGraph(const std::vector<std::vector<PietColor>> &grid) {
-    nodes.clear();
-    computeBlocks(grid);
-    if (blocks.empty()) return;
+// --- Helper: stateKey ---
+// The key of state (blockId, dp, cc) in the state map.
+static uint64_t stateKey(int blockId, Direction dp, CodelChooser cc) {
+    return (static_cast<uint64_t>(blockId) << 3) | (static_cast<uint64_t>(dp) << 1) |
+           static_cast<uint64_t>(cc);
+}
 
-    // If the color of the top–left codel is black or white, we cannot start.
-    if (grid[0][0] == PietColor::Black || grid[0][0] == PietColor::White) return;
+// --- ExploreState ---
+// Simulate Piet movement out of a block with the given DP and CC, following the DP/CC rules:
+// find the exit codel, retry with toggled CC and rotated DP while the way is blocked, and slide
+// through white codels.
+Graph::StateExit Graph::exploreState(const Block &curBlock, Direction dp, CodelChooser cc,
+                                     const std::vector<std::vector<PietColor>> &grid) {
+    int rows = grid.size();
+    int cols = grid[0].size();
+    StateExit result;
 
-    // Find the block that contains the top–left pixel (0,0).
-    int initialBlockId = findBlockId(0, 0);
-    if (initialBlockId < 0) return;
+    // --- Attempt to compute a valid exit ---
+    bool foundExit = false;
+    Direction trialDP = dp;
+    CodelChooser trialCC = cc;
+    std::pair<int,int> exitCoord, candidate;
+    for (int attempt = 0; attempt < 8; ++attempt) {
+        exitCoord = getExitCodel(curBlock, trialDP, trialCC, grid);
+        candidate = getNextCodel(exitCoord, trialDP);
+        int r = candidate.first, c = candidate.second;
+        // Check bounds and whether candidate is not black.
+        if (!inBounds(r, c, rows, cols) || grid[r][c] == PietColor::Black) {
+            if (inBounds(r, c, rows, cols))
+                result.footprint.add(r, c);
+            // No valid candidate this attempt.
+            // Piet rule: first toggle CC on even attempts, then rotate DP on odd attempts.
+            if (attempt % 2 == 0)
+                trialCC = toggleCC(trialCC);
+            else
+                trialDP = rotateDP(trialDP, 1);
+            continue;
+        } else {
+            result.footprint.add(r, c);
+            foundExit = true;
+            break;
+        }
+    }
+    if (!foundExit) {
+        // Terminal state; no valid exit.
+        return result;
+    }
 
-    // Worklist: store indices of nodes to process.
-    std::vector<int> worklist;
-    // Map key: (blockId, dp, cc) encoded as a tuple; value: node id.
-    struct StateKey { int blockId; int dp; int cc; };
-    auto keyHash = [](const StateKey &k) { return k.blockId * 100 + k.dp * 10 + k.cc; };
-    std::vector<StateKey> stateKeys;
-    std::map<int, int> stateMap; // keyHash -> node id (for simplicity; collisions are unlikely for our demo)
-
-    auto makeKey = [&](int bid, Direction d, CodelChooser c) -> int {
-        StateKey key{ bid, static_cast<int>(d), static_cast<int>(c) };
-        return keyHash(key);
-    };
+    // If the candidate is white, follow the white region until reaching a colored block.
+    bool slidedWhite = inBounds(candidate.first, candidate.second, rows, cols) &&
+                       grid[candidate.first][candidate.second] == PietColor::White;
+    if (slidedWhite) {
+        // We now slide through white blocks according to the Piet specification.
+        // Save the starting white sliding state for cycle detection.
+        std::set<std::tuple<std::pair<int,int>, Direction, CodelChooser>> visitedWhite;
+        visitedWhite.emplace(candidate, trialDP, trialCC);
+        std::pair<int,int> lastWhite = candidate;
+
+        // Loop to slide through the white region.
+        while (true) {
+            // Slide in a straight line along the DP while the candidate is white.
+            while (inBounds(candidate.first, candidate.second, rows, cols) &&
+                   grid[candidate.first][candidate.second] == PietColor::White) {
+                result.footprint.add(candidate.first, candidate.second);
+                lastWhite = candidate; // record the last white codel encountered
+                candidate = getNextCodel(candidate, trialDP);
+            }
+            if (inBounds(candidate.first, candidate.second, rows, cols))
+                result.footprint.add(candidate.first, candidate.second);
 
-    // Create initial state.
-    GraphNode init;
-    init.id = 0;
-    init.blockId = initialBlockId;
-    init.blockSize = blocks[initialBlockId].size;
-    init.dp = Direction::Right;
-    init.cc = CodelChooser::Left;
-    nodes.push_back(init);
-    worklist.push_back(0);
-    stateMap[makeKey(initialBlockId, init.dp, init.cc)] = 0;
+            // Now candidate is either out-of-bounds, black, or colored.
+            if (!inBounds(candidate.first, candidate.second, rows, cols) ||
+                grid[candidate.first][candidate.second] == PietColor::Black) {
+                // A restriction is encountered while sliding.
+                // According to the specification, toggle the CC and rotate the DP clockwise.
+                trialCC = toggleCC(trialCC);
+                trialDP = rotateDP(trialDP, 1);
 
-    int rows = grid.size();
-    int cols = grid[0].size();
+                // Check if we have begun retracing our route: if we have returned to the
+                // initial white sliding state (same candidate, DP, and CC), then there is no way out.
+                if (visitedWhite.find({candidate, trialDP, trialCC}) != visitedWhite.end()) {
+                    foundExit = false;
+                    break; // No exit possible; break out of white-sliding loop.
+                }
+                visitedWhite.emplace(lastWhite, trialDP, trialCC);
+                // Otherwise, reset candidate to the last white codel encountered
+                // and try sliding again in the new direction.
+                candidate = lastWhite;
+                continue; // Reattempt the sliding with updated trialDP/trialCC.
+            } else {
+                // Candidate is a colored codel (neither white, black, nor out-of-bounds).
+                // We have an exit.
+                break;
+            }
+        }
+    }
+    // No exit was found from the white region: a terminal state.
+    if (!foundExit)
+        return result;
+
+    // If out-of-bounds or black after following white, then terminate.
+    if (!inBounds(candidate.first, candidate.second, rows, cols) ||
+        grid[candidate.first][candidate.second] == PietColor::Black)
+        return result;
+
+    result.found = true;
+    result.target = candidate;
+    result.slid = slidedWhite;
+    result.dp = trialDP;
+    result.cc = trialCC;
+    return result;
+}
+
+// --- Explore ---
+// Traverse the states reachable from the initial state with a worklist. Transitions of states
+// that existed before are reused if neither their block, their target blocks nor any codel
+// examined when leaving the block changed (their footprint misses dirty); all other states are
+// explored again. States keep their node ids; unreachable ones are left in place as terminal
+// nodes. Returns the number of states explored.
+int Graph::explore(const std::vector<std::vector<PietColor>> &grid, const CodelRect &dirty) {
+    std::vector<GraphNode> oldNodes = nodes;
+    std::vector<GraphEdge> oldEdges = std::move(edges);
+    std::vector<CodelRect> oldFootprints = std::move(footprints);
+    edges.clear();
+    footprints.assign(nodes.size(), CodelRect::all(labelRows, labelCols));
+    std::vector<bool> reached(nodes.size(), false);
+    for (auto &node : nodes)
+        node.numEdges = 0;
+    int explored = 0;
+
+    // Label the block that contains the top–left pixel (0,0) and create the initial state.
+    int initialBlockId = labelBlock(0, 0, grid);
+    if (nodes.empty()) {
+        GraphNode init;
+        init.blockId = initialBlockId;
+        init.blockSize = blocks[initialBlockId].size;
+        init.firstEdge = 0;
+        init.numEdges = 0;
+        init.dp = Direction::Right;
+        init.cc = CodelChooser::Left;
+        nodes.push_back(init);
+        footprints.push_back(CodelRect::all(labelRows, labelCols));
+        reached.push_back(false);
+        stateIds[stateKey(initialBlockId, init.dp, init.cc)] = 0;
+    }
+
+    // Worklist: store indices of nodes to process.
+    std::vector<int> worklist = { 0 };
+    reached[0] = true;
 
     // Process worklist.
     while (!worklist.empty()) {
         int curId = worklist.back();
         worklist.pop_back();
         GraphNode curState = nodes[curId];
-        Block curBlock = blocks[curState.blockId];
-
-        // --- Attempt to compute a valid exit ---
-        bool foundExit = false;
-        Direction trialDP = curState.dp;
-        CodelChooser trialCC = curState.cc;
-        std::pair<int,int> exitCoord, candidate;
-        for (int attempt = 0; attempt < 8; ++attempt) {
-            exitCoord = getExitCodel(curBlock, trialDP, trialCC, grid);
-            candidate = getNextCodel(exitCoord, trialDP);
-            int r = candidate.first, c = candidate.second;
-            // Check bounds and whether candidate is not black.
-            if (!inBounds(r, c, rows, cols) || grid[r][c] == PietColor::Black) {
-                // No valid candidate this attempt.
-                // Piet rule: first toggle CC on even attempts, then rotate DP on odd attempts.
-                if (attempt % 2 == 0)
-                    trialCC = toggleCC(trialCC);
-                else
-                    trialDP = rotateDP(trialDP, 1);
-                continue;
-            } else {
-                foundExit = true;
-                break;
-            }
-        }
-        if (!foundExit) {
-            // Terminal state; no valid exit.
-            continue;
-        }
 
-        // If the candidate is white, follow the white region until reaching a colored block.
-        // while (inBounds(candidate.first, candidate.second, rows, cols) &&
-        //        grid[candidate.first][candidate.second] == PietColor::White) {
-        //     candidate = getNextCodel(candidate, trialDP);
-        // }
-        bool slidedWhite = inBounds(candidate.first, candidate.second, rows, cols) &&
-                           grid[candidate.first][candidate.second] == PietColor::White;
-        if (slidedWhite) {
-            // We now slide through white blocks according to the Piet specification.
-            // Save the starting white sliding state for cycle detection.
-            std::set<std::tuple<std::pair<int,int>, Direction, CodelChooser>> visitedWhite;
-            visitedWhite.emplace(candidate, trialDP, trialCC);
-            std::pair<int,int> lastWhite = candidate;
-        
-            // Loop to slide through the white region.
-            while (true) {
-                // Slide in a straight line along the DP while the candidate is white.
-                while (inBounds(candidate.first, candidate.second, rows, cols) &&
-                       grid[candidate.first][candidate.second] == PietColor::White) {
-                    lastWhite = candidate; // record the last white codel encountered
-                    candidate = getNextCodel(candidate, trialDP);
-                }
-                
-                // Now candidate is either out-of-bounds, black, or colored.
-                if (!inBounds(candidate.first, candidate.second, rows, cols) ||
-                    grid[candidate.first][candidate.second] == PietColor::Black) {
-                    // A restriction is encountered while sliding.
-                    // According to the specification, toggle the CC and rotate the DP clockwise.
-                    trialCC = toggleCC(trialCC);
-                    trialDP = rotateDP(trialDP, 1);
-        
-                    // Check if we have begun retracing our route: if we have returned to the
-                    // initial white sliding state (same candidate, DP, and CC), then there is no way out.
-                    if (visitedWhite.find({candidate, trialDP, trialCC}) != visitedWhite.end()) {
-                        foundExit = false;
-                        break; // No exit possible; break out of white-sliding loop.
+        // Reuse the transitions computed before, if nothing they depend on changed.
+        if (static_cast<size_t>(curId) < oldFootprints.size() &&
+            !oldFootprints[curId].intersects(dirty)) {
+            EdgeRange old{ oldEdges.data() + oldNodes[curId].firstEdge,
+                           oldEdges.data() + oldNodes[curId].firstEdge + oldNodes[curId].numEdges };
+            bool valid = true;
+            for (const auto &edge : old)
+                valid = valid && blocks[oldNodes[edge.targetNode].blockId].size > 0;
+            if (valid) {
+                nodes[curId].firstEdge = edges.size();
+                nodes[curId].numEdges = old.size();
+                footprints[curId] = oldFootprints[curId];
+                for (const auto &edge : old) {
+                    edges.push_back(edge);
+                    if (!reached[edge.targetNode]) {
+                        reached[edge.targetNode] = true;
+                        worklist.push_back(edge.targetNode);
                     }
-                    visitedWhite.emplace(lastWhite, trialDP, trialCC);
-                    // Otherwise, reset candidate to the last white codel encountered
-                    // and try sliding again in the new direction.
-                    candidate = lastWhite;
-                    continue; // Reattempt the sliding with updated trialDP/trialCC.
-                } else {
-                    // Candidate is a colored codel (neither white, black, nor out-of-bounds).
-                    // We have an exit.
-                    break;
                 }
+                continue;
             }
         }
-        if (!foundExit) {
-            // Handle the terminal case: no exit was found from the white region.
-            // (For example, you may mark the current state as terminal and/or break out.)
-            continue;  // or set the appropriate termination condition.
-        }
-
-        // If out-of-bounds or black after following white, then terminate.
-        if (!inBounds(candidate.first, candidate.second, rows, cols) ||
-            grid[candidate.first][candidate.second] == PietColor::Black)
-            continue;
 
-        int targetBlockId = findBlockId(candidate.first, candidate.second);
-        if (targetBlockId < 0)
+        ++explored;
+        StateExit exit = exploreState(blocks[curState.blockId], curState.dp, curState.cc, grid);
+        footprints[curId] = exit.footprint;
+        if (!exit.found)
             continue;
+        // Labeling the target block may grow the block array, so only the color is used after it.
+        PietColor curColor = blocks[curState.blockId].color;
+        int targetBlockId = labelBlock(exit.target.first, exit.target.second, grid);
 
         // Compute the command from current block color to the target block's color.
-        Command cmd = slidedWhite ? Command::None
-                                  : getCommand(curBlock.color, blocks[targetBlockId].color);
+        Command cmd = exit.slid ? Command::None
+                                : getCommand(curColor, blocks[targetBlockId].color);
 
         // Determine possible new DP/CC outcomes.
         std::vector<std::pair<Direction, CodelChooser>> outcomes;
         if (cmd == Command::Pointer) {
             // Pointer command: the DP rotates; for demonstration we add all four possibilities.
             for (int i = 0; i < 4; i++) {
-                outcomes.push_back({rotateDP(trialDP, i), trialCC});
+                outcomes.push_back({rotateDP(exit.dp, i), exit.cc});
             }
         } else if (cmd == Command::Switch) {
             // Switch command: the CC toggles (or not). Two possibilities.
-            outcomes.push_back({trialDP, trialCC});
-            outcomes.push_back({trialDP, toggleCC(trialCC)});
+            outcomes.push_back({exit.dp, exit.cc});
+            outcomes.push_back({exit.dp, toggleCC(exit.cc)});
         } else {
-            outcomes.push_back({trialDP, trialCC});
+            outcomes.push_back({exit.dp, exit.cc});
         }
 
         // For each outcome, create (or reuse) a new state and add an edge.
+        // All transitions of the current node are appended to the edge array together.
+        nodes[curId].firstEdge = edges.size();
+        nodes[curId].numEdges = outcomes.size();
         for (const auto &outcome : outcomes) {
             Direction newDP = outcome.first;
             CodelChooser newCC = outcome.second;
-            int key = makeKey(targetBlockId, newDP, newCC);
-            int targetNodeId;
-            if (stateMap.find(key) == stateMap.end()) {
+            auto inserted = stateIds.emplace(stateKey(targetBlockId, newDP, newCC), nodes.size());
+            int targetNodeId = inserted.first->second;
+            if (inserted.second) {
                 // Create a new state.
                 GraphNode newState;
-                newState.id = nodes.size();
                 newState.blockId = targetBlockId;
                 newState.blockSize = blocks[targetBlockId].size;
+                newState.firstEdge = 0;
+                newState.numEdges = 0;
                 newState.dp = newDP;
                 newState.cc = newCC;
                 nodes.push_back(newState);
-                targetNodeId = newState.id;
-                stateMap[key] = targetNodeId;
+                footprints.push_back(CodelRect::all(labelRows, labelCols));
+                reached.push_back(false);
+            }
+            if (!reached[targetNodeId]) {
+                reached[targetNodeId] = true;
                 worklist.push_back(targetNodeId);
-            } else {
-                targetNodeId = stateMap[key];
             }
             // Add an edge from the current state to the target state with the computed command.
-            GraphEdge edge;
+            GraphEdge edge{};
             edge.targetNode = targetNodeId;
             edge.command = cmd;
-            nodes[curId].transitions.push_back(edge);
+            edges.push_back(edge);
+        }
+    }
+
+    // Unreachable states keep their ids as terminal nodes; they are explored again if they
+    // become reachable.
+    unreachableNodes = 0;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (!reached[i]) {
+            nodes[i].firstEdge = 0;
+            ++unreachableNodes;
         }
     }
+    return explored;
 }
 
-const std::vector<GraphNode>& Graph::getNodes() const {
-    return nodes;
+// --- BuildGraph ---
+// Label blocks lazily and explore every state reachable from the initial state.
+void Graph::buildGraph(const std::vector<std::vector<PietColor>> &grid) {
+    nodes.clear();
+    edges.clear();
+    mapping.reset();
+    blocks.clear();
+    labels.clear();
+    footprints.clear();
+    stateIds.clear();
+    labelRows = labelCols = 0;
+    if (grid.empty() || grid[0].empty()) return;
+
+    // Blocks are labeled lazily: a block is flood-filled the first time the exploration lands
+    // on one of its codels, so areas that execution never reaches are never labeled.
+    labelRows = grid.size();
+    labelCols = grid[0].size();
+    labels.assign(static_cast<size_t>(labelRows) * labelCols, -1);
+
+    // If the color of the top–left codel is black or white, we cannot start.
+    if (grid[0][0] == PietColor::Black || grid[0][0] == PietColor::White) return;
+
+    explore(grid, CodelRect());
+}
+
+// --- UpdateGraph ---
+// Blocks with a codel in or next to the dirty rectangle are relabeled (their ids are retired and
+// the blocks labeled again, under new ids, when reached); every other block and label is kept.
+int Graph::updateGraph(const std::vector<std::vector<PietColor>> &grid, const CodelRect &dirty) {
+    bool incremental = !mapping && !nodes.empty() && footprints.size() == nodes.size() &&
+                       static_cast<int>(grid.size()) == labelRows && labelRows > 0 &&
+                       static_cast<int>(grid[0].size()) == labelCols;
+    CodelRect affected = dirty;
+    if (incremental && !dirty.empty()) {
+        affected = CodelRect{ std::max(dirty.top - 1, 0), std::max(dirty.left - 1, 0),
+                              std::min(dirty.bottom + 1, labelRows - 1),
+                              std::min(dirty.right + 1, labelCols - 1) };
+        // The start block must keep node 0.
+        incremental = !affected.contains(0, 0) && blocks[findBlockId(0, 0)].size > 0;
+    }
+    if (incremental) {
+        for (int r = affected.top; r <= affected.bottom && incremental; ++r) {
+            for (int c = affected.left; c <= affected.right; ++c) {
+                int id = findBlockId(r, c);
+                if (id < 0)
+                    continue;
+                if (id == findBlockId(0, 0)) {
+                    incremental = false;
+                    break;
+                }
+                for (const auto &cell : blocks[id].cells)
+                    labels[static_cast<size_t>(cell.first) * labelCols + cell.second] = -1;
+                blocks[id].cells.clear();
+                blocks[id].cells.shrink_to_fit();
+                blocks[id].size = 0;
+            }
+        }
+    }
+    if (!incremental) {
+        buildGraph(grid);
+        return size();
+    }
+    int explored = explore(grid, affected);
+
+    // Start over once most node ids belong to states that are no longer reachable.
+    if (nodes.size() > 1024 && unreachableNodes > nodes.size() / 2) {
+        buildGraph(grid);
+        return size();
+    }
+    return explored;
+}
+
+const GraphNode *Graph::nodeData() const {
+    return mapping ? mappedNodes : nodes.data();
+}
+
+const GraphEdge *Graph::edgeData() const {
+    return mapping ? mappedEdges : edges.data();
+}
+
+size_t Graph::size() const {
+    return mapping ? mappedNumNodes : nodes.size();
+}
+
+bool Graph::empty() const {
+    return size() == 0;
+}
+
+std::pair<int,int> Graph::blockOrigin(int blockId) const {
+    return blocks[blockId].origin;
+}
+
+PietColor Graph::blockColor(int blockId) const {
+    return blocks[blockId].color;
+}
+
+size_t Graph::numEdges() const {
+    return mapping ? mappedNumEdges : edges.size();
+}
+
+const GraphNode& Graph::getNode(int id) const {
+    return nodeData()[id];
+}
+
+EdgeRange Graph::getTransitions(const GraphNode &node) const {
+    const GraphEdge *first = edgeData() + node.firstEdge;
+    return EdgeRange{ first, first + node.numEdges };
+}
+
+EdgeRange Graph::getTransitions(int id) const {
+    return getTransitions(getNode(id));
+}
+
+Graph Graph::subgraphFrom(int start) const {
+    Graph sub;
+    sub.blocks = blocks;
+
+    // Number the reachable nodes in breadth-first order from start.
+    std::vector<int> newId(size(), -1);
+    std::vector<int> order = { start };
+    newId[start] = 0;
+    for (size_t i = 0; i < order.size(); ++i) {
+        for (const auto &edge : getTransitions(order[i])) {
+            if (newId[edge.targetNode] < 0) {
+                newId[edge.targetNode] = order.size();
+                order.push_back(edge.targetNode);
+            }
+        }
+    }
+    for (int old : order) {
+        GraphNode node = getNode(old);
+        EdgeRange transitions = getTransitions(old);
+        node.firstEdge = sub.edges.size();
+        for (GraphEdge edge : transitions) {
+            edge.targetNode = newId[edge.targetNode];
+            sub.edges.push_back(edge);
+        }
+        sub.nodes.push_back(node);
+    }
+    return sub;
+}
+
+// --- Minimize ---
+// Two states are equivalent when they execute the same commands (a Push also pushes the same
+// block size) and their i-th transitions lead to equivalent states for every i. The coarsest
+// such partition is computed with Hopcroft's algorithm, treating the transition index as the
+// input symbol.
+int Graph::minimize() {
+    int n = size();
+    if (n == 0) return 0;
+
+    // Initial partition: by out-degree, the commands on the edges and, for Push, the value pushed.
+    std::map<std::vector<int>, int> signatures;
+    std::vector<int> initialClass(n);
+    int numSymbols = 0;
+    for (int i = 0; i < n; ++i) {
+        const GraphNode &node = getNode(i);
+        EdgeRange transitions = getTransitions(node);
+        std::vector<int> sig;
+        sig.push_back(transitions.size());
+        for (const auto &edge : transitions)
+            sig.push_back(static_cast<int>(edge.command));
+        if (transitions.size() == 1 && transitions[0].command == Command::Push)
+            sig.push_back(node.blockSize);
+        initialClass[i] = signatures.emplace(sig, signatures.size()).first->second;
+        numSymbols = std::max<int>(numSymbols, transitions.size());
+    }
+
+    // Refinable partition: the members of each class are contiguous in elems, and the marked
+    // members of a class are kept at the front of its range.
+    struct Class { int begin, end, marked; };
+    std::vector<Class> classes(signatures.size(), Class{0, 0, 0});
+    std::vector<int> elems(n), pos(n), cls(initialClass);
+    for (int i = 0; i < n; ++i)
+        classes[cls[i]].end++;
+    // Turn the class sizes into ranges, then fill them.
+    int offset = 0;
+    for (auto &c : classes) {
+        int size = c.end;
+        c.begin = c.end = offset;
+        offset += size;
+    }
+    for (int i = 0; i < n; ++i) {
+        Class &c = classes[cls[i]];
+        pos[i] = c.end;
+        elems[c.end++] = i;
+    }
+
+    // preds[a * n + t]: the nodes whose a-th transition leads to t.
+    std::vector<std::vector<int>> preds(static_cast<size_t>(numSymbols) * n);
+    for (int i = 0; i < n; ++i) {
+        EdgeRange transitions = getTransitions(i);
+        for (size_t a = 0; a < transitions.size(); ++a)
+            preds[a * n + transitions[a].targetNode].push_back(i);
+    }
+
+    // Worklist of splitters (class, symbol).
+    std::vector<std::pair<int,int>> worklist;
+    std::vector<std::vector<bool>> inWork(classes.size(), std::vector<bool>(numSymbols, true));
+    for (size_t c = 0; c < classes.size(); ++c)
+        for (int a = 0; a < numSymbols; ++a)
+            worklist.push_back({static_cast<int>(c), a});
+
+    std::vector<int> splitter, touched;
+    while (!worklist.empty()) {
+        auto [splitClass, symbol] = worklist.back();
+        worklist.pop_back();
+        inWork[splitClass][symbol] = false;
+        splitter.assign(elems.begin() + classes[splitClass].begin,
+                        elems.begin() + classes[splitClass].end);
+
+        // Mark every node whose symbol-th transition enters the splitter.
+        for (int target : splitter) {
+            for (int x : preds[symbol * n + target]) {
+                Class &c = classes[cls[x]];
+                int first = c.begin + c.marked;
+                if (pos[x] < first) continue; // Already marked.
+                int other = elems[first];
+                std::swap(elems[pos[x]], elems[first]);
+                pos[other] = pos[x];
+                pos[x] = first;
+                if (c.marked++ == 0)
+                    touched.push_back(cls[x]);
+            }
+        }
+
+        // Split each touched class into its marked and unmarked members.
+        for (int y : touched) {
+            Class &c = classes[y];
+            int marked = c.marked;
+            c.marked = 0;
+            if (marked == c.end - c.begin)
+                continue;
+            int z = classes.size();
+            Class split{c.begin, c.begin + marked, 0};
+            c.begin += marked;
+            classes.push_back(split);
+            for (int k = split.begin; k < split.end; ++k)
+                cls[elems[k]] = z;
+            inWork.push_back(std::vector<bool>(numSymbols, false));
+            int ySize = classes[y].end - classes[y].begin;
+            for (int a = 0; a < numSymbols; ++a) {
+                int add = (inWork[y][a] || marked < ySize) ? z : y;
+                if (!inWork[add][a]) {
+                    inWork[add][a] = true;
+                    worklist.push_back({add, a});
+                }
+            }
+        }
+        touched.clear();
+    }
+
+    // Build the quotient graph. The class of the initial node becomes node 0; the others are
+    // numbered in order of their lowest member, which also serves as the representative.
+    std::vector<int> newId(classes.size(), -1);
+    std::vector<int> representative;
+    newId[cls[0]] = 0;
+    representative.push_back(0);
+    for (int i = 1; i < n; ++i) {
+        if (newId[cls[i]] < 0) {
+            newId[cls[i]] = representative.size();
+            representative.push_back(i);
+        }
+    }
+    std::vector<GraphNode> mergedNodes;
+    std::vector<GraphEdge> mergedEdges;
+    mergedNodes.reserve(representative.size());
+    for (int rep : representative) {
+        GraphNode node = getNode(rep);
+        EdgeRange transitions = getTransitions(node);
+        node.firstEdge = mergedEdges.size();
+        for (GraphEdge edge : transitions) {
+            edge.targetNode = newId[cls[edge.targetNode]];
+            mergedEdges.push_back(edge);
+        }
+        mergedNodes.push_back(node);
+    }
+    int removed = n - mergedNodes.size();
+    nodes = std::move(mergedNodes);
+    edges = std::move(mergedEdges);
+    mapping.reset();
+    // Merged states have no single footprint; updateGraph starts over.
+    footprints.clear();
+    stateIds.clear();
+    return removed;
+}
+
+// --- Graph files ---
+// Helper: round an offset up to the 16-byte alignment of the arrays in a graph file.
+static uint64_t alignTo16(uint64_t offset) {
+    return (offset + 15) & ~uint64_t(15);
+}
+
+void Graph::serialize(std::string &out) const {
+    GraphFileHeader header;
+    std::memcpy(header.magic, kGraphFileMagic, sizeof(header.magic));
+    header.version = kGraphFileVersion;
+    header.numNodes = size();
+    header.numEdges = numEdges();
+    header.reserved = 0;
+    header.nodesOffset = alignTo16(sizeof(GraphFileHeader));
+    header.edgesOffset = alignTo16(header.nodesOffset + sizeof(GraphNode) * header.numNodes);
+
+    // Padding between the parts is zero-filled by the resize.
+    out.assign(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.resize(header.edgesOffset + sizeof(GraphEdge) * header.numEdges, 0);
+    std::memcpy(&out[header.nodesOffset], nodeData(), sizeof(GraphNode) * header.numNodes);
+    std::memcpy(&out[header.edgesOffset], edgeData(), sizeof(GraphEdge) * header.numEdges);
+}
+
+bool Graph::save(const std::string &filename) const {
+    std::string data;
+    serialize(data);
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) {
+        reportError("Cannot open file " + filename);
+        return false;
+    }
+    out.write(data.data(), data.size());
+    return static_cast<bool>(out);
+}
+
+bool Graph::isGraphFile(const std::string &filename) {
+    std::ifstream in(filename, std::ios::binary);
+    char magic[sizeof(kGraphFileMagic)];
+    return in.read(magic, sizeof(magic)) && std::memcmp(magic, kGraphFileMagic, sizeof(magic)) == 0;
+}
+
+bool Graph::load(const std::string &filename) {
+    namespace fs = llvm::sys::fs;
+    uint64_t fileSize = 0;
+    llvm::Expected<fs::file_t> opened = fs::openNativeFileForRead(filename);
+    if (!opened) {
+        llvm::consumeError(opened.takeError());
+        reportError("Cannot open file " + filename);
+        return false;
+    }
+    fs::file_t file = *opened;
+    if (fs::file_size(filename, fileSize) || fileSize < sizeof(GraphFileHeader)) {
+        fs::closeFile(file);
+        reportError(filename + " is not a graph file");
+        return false;
+    }
+    std::error_code ec;
+    auto region = std::make_shared<fs::mapped_file_region>(file, fs::mapped_file_region::readonly,
+                                                           fileSize, 0, ec);
+    fs::closeFile(file);
+    if (ec) {
+        reportError("cannot map " + filename + ": " + ec.message());
+        return false;
+    }
+    const char *data = region->const_data();
+
+    // Validate the header and the array bounds before using anything in place.
+    GraphFileHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, kGraphFileMagic, sizeof(header.magic)) != 0 ||
+        header.version != kGraphFileVersion) {
+        reportError(filename + " is not a version " + std::to_string(kGraphFileVersion) +
+                    " graph file");
+        return false;
+    }
+    if (header.nodesOffset % 16 != 0 || header.edgesOffset % 16 != 0 ||
+        header.nodesOffset > fileSize ||
+        (fileSize - header.nodesOffset) / sizeof(GraphNode) < header.numNodes ||
+        header.edgesOffset > fileSize ||
+        (fileSize - header.edgesOffset) / sizeof(GraphEdge) < header.numEdges) {
+        reportError("graph file " + filename + " is truncated");
+        return false;
+    }
+    const GraphNode *fileNodes = reinterpret_cast<const GraphNode*>(data + header.nodesOffset);
+    const GraphEdge *fileEdges = reinterpret_cast<const GraphEdge*>(data + header.edgesOffset);
+    // Every edge range and target must be in bounds, since code generation indexes by them, and
+    // every DP, CC and command must be a value of its enum, since code generation switches on them.
+    for (uint32_t i = 0; i < header.numNodes; ++i) {
+        if (fileNodes[i].firstEdge > header.numEdges ||
+            fileNodes[i].numEdges > header.numEdges - fileNodes[i].firstEdge ||
+            static_cast<uint8_t>(fileNodes[i].dp) > static_cast<uint8_t>(Direction::Up) ||
+            static_cast<uint8_t>(fileNodes[i].cc) > static_cast<uint8_t>(CodelChooser::Right)) {
+            reportError("graph file " + filename + " is corrupt");
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header.numEdges; ++i) {
+        const GraphEdge &edge = fileEdges[i];
+        if (edge.targetNode >= header.numNodes ||
+            static_cast<uint8_t>(edge.command) > static_cast<uint8_t>(Command::OutputChar) ||
+            edge.reserved[0] != 0 || edge.reserved[1] != 0 || edge.reserved[2] != 0) {
+            reportError("graph file " + filename + " is corrupt");
+            return false;
+        }
+    }
+
+    nodes.clear();
+    edges.clear();
+    blocks.clear();
+    labels.clear();
+    footprints.clear();
+    stateIds.clear();
+    labelRows = labelCols = 0;
+    mapping = std::move(region);
+    mappedNodes = fileNodes;
+    mappedEdges = fileEdges;
+    mappedNumNodes = header.numNodes;
+    mappedNumEdges = header.numEdges;
+    return true;
 }
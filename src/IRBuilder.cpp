@@ -1,188 +1,794 @@
 #include "IRBuilder.h"
 #include "StackVM.h"
+#include "PietRuntime.h"
+#include "Diagnostics.h"
+#include "llvm/IR/Constants.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/xxhash.h"
 #include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <map>
+#include <set>
 
 using namespace llvm;
 
-IRGenerator::IRGenerator(LLVMContext &ctx) : context(ctx) { }
+// Upper bound on the number of nodes packed into one region function.
+static const int kMaxRegionNodes = 2048;
+// Larger proven stack depths are not preallocated; pushes then keep the growth check.
+static const int kMaxPreallocatedDepth = 1 << 20;
 
-Module* IRGenerator::generateModule(const Graph &graph) {
-    Module *module = new Module("PietModule", context);
-    IRBuilder<> builder(context);
+IRGenerator::IRGenerator(LLVMContext &ctx) : context(ctx), partitionThreshold(4096) { }
 
-    // Declare external runtime functions.
+void IRGenerator::setPartitionThreshold(int threshold) {
+    partitionThreshold = threshold;
+}
+
+void IRGenerator::setTrace(bool enabled) {
+    trace = enabled;
+}
+
+void IRGenerator::setGuardedStack(bool enabled) {
+    guardedStack = enabled;
+}
+
+void IRGenerator::setFuel(uint64_t budget) {
+    // ctx->fuel is signed; a larger budget is as good as unlimited anyway.
+    fuel = std::min<uint64_t>(budget, LLONG_MAX);
+}
+
+void IRGenerator::setInitialState(const std::vector<int> &stack, const std::string &output) {
+    initialStack = stack;
+    initialOutput = output;
+}
+
+void IRGenerator::declareRuntime(Module *module) {
     PointerType *stackPtrTy = PointerType::getUnqual(Type::getInt8Ty(context));
 
     FunctionType *pushType = FunctionType::get(Type::getVoidTy(context),
                                                {stackPtrTy, Type::getInt32Ty(context)}, false);
-    Function *stackPushF = Function::Create(pushType, Function::ExternalLinkage, "stackPush", module);
+    stackPushF = Function::Create(pushType, Function::ExternalLinkage, "stackPush", module);
 
     FunctionType *popType = FunctionType::get(Type::getInt32Ty(context),
                                               {stackPtrTy}, false);
-    Function *stackPopF = Function::Create(popType, Function::ExternalLinkage, "stackPop", module);
-
-    FunctionType *createType = FunctionType::get(stackPtrTy, {}, false);
-    Function *createStackF = Function::Create(createType, Function::ExternalLinkage, "createStack", module);
-
-    FunctionType *destroyType = FunctionType::get(Type::getVoidTy(context),
-                                                  {stackPtrTy}, false);
-    Function *destroyStackF = Function::Create(destroyType, Function::ExternalLinkage, "destroyStack", module);
+    stackPopF = Function::Create(popType, Function::ExternalLinkage, "stackPop", module);
 
     FunctionType *rollType = FunctionType::get(Type::getVoidTy(context),
                                                {stackPtrTy, Type::getInt32Ty(context), Type::getInt32Ty(context)},
                                                false);
-    Function *stackRollF = Function::Create(rollType, Function::ExternalLinkage, "stackRoll", module);
+    stackRollF = Function::Create(rollType, Function::ExternalLinkage, "stackRoll", module);
 
-    FunctionType *putcharType = FunctionType::get(Type::getInt32Ty(context),
-                                                  {Type::getInt32Ty(context)}, false);
-    Function *putcharF = Function::Create(putcharType, Function::ExternalLinkage, "putchar", module);
+    // Contexts (piet_ctx*, see PietRuntime.h) are passed as i8* too.
+    PointerType *ctxPtrTy = stackPtrTy;
+    FunctionType *prepareType = FunctionType::get(stackPtrTy, {ctxPtrTy, Type::getInt32Ty(context)},
+                                                  false);
+    prepareStackF = Function::Create(prepareType, Function::ExternalLinkage, "pietPrepareStack", module);
+    if (useGuardedStack) {
+        FunctionType *prepareGuardedType = FunctionType::get(stackPtrTy, {ctxPtrTy}, false);
+        prepareGuardedStackF = Function::Create(prepareGuardedType, Function::ExternalLinkage,
+                                                "pietPrepareGuardedStack", module);
+    }
 
-    // Create main function: int main()
-    FunctionType *mainType = FunctionType::get(Type::getInt32Ty(context), false);
-    Function *mainFunc = Function::Create(mainType, Function::ExternalLinkage, "main", module);
-    BasicBlock *entryBB = BasicBlock::Create(context, "entry", mainFunc);
+    if (!initialStack.empty()) {
+        FunctionType *loadType = FunctionType::get(Type::getVoidTy(context),
+                                                   {stackPtrTy, PointerType::getUnqual(Type::getInt32Ty(context)),
+                                                    Type::getInt32Ty(context)}, false);
+        stackLoadF = Function::Create(loadType, Function::ExternalLinkage, "stackLoad", module);
+    }
+    if (!initialOutput.empty()) {
+        FunctionType *writeType = FunctionType::get(Type::getVoidTy(context),
+                                                    {ctxPtrTy, stackPtrTy, Type::getInt32Ty(context)}, false);
+        writeOutputF = Function::Create(writeType, Function::ExternalLinkage, "pietWriteOutput", module);
+    }
+
+    FunctionType *createCtxType = FunctionType::get(ctxPtrTy, {}, false);
+    createStdioContextF = Function::Create(createCtxType, Function::ExternalLinkage,
+                                           "pietCreateStdioContext", module);
+
+    FunctionType *ctxOnlyType = FunctionType::get(Type::getVoidTy(context), {ctxPtrTy}, false);
+    destroyContextF = Function::Create(ctxOnlyType, Function::ExternalLinkage, "pietDestroyContext", module);
+    inputCharF = Function::Create(ctxOnlyType, Function::ExternalLinkage, "pietInputChar", module);
+    inputNumF = Function::Create(ctxOnlyType, Function::ExternalLinkage, "pietInputNum", module);
+
+    FunctionType *outputType = FunctionType::get(Type::getVoidTy(context),
+                                                 {ctxPtrTy, Type::getInt32Ty(context)}, false);
+    outputCharF = Function::Create(outputType, Function::ExternalLinkage, "pietOutputChar", module);
+    outputNumF = Function::Create(outputType, Function::ExternalLinkage, "pietOutputNum", module);
+
+    if (trace) {
+        FunctionType *traceStartType = FunctionType::get(Type::getVoidTy(context),
+                                                         {Type::getInt32Ty(context)}, false);
+        traceStartF = Function::Create(traceStartType, Function::ExternalLinkage, "pietTraceStart",
+                                       module);
+        FunctionType *traceType = FunctionType::get(Type::getVoidTy(context),
+                                                    {stackPtrTy, Type::getInt32Ty(context),
+                                                     Type::getInt32Ty(context)}, false);
+        traceF = Function::Create(traceType, Function::ExternalLinkage, "pietTrace", module);
+    }
+
+    // The layout of struct Stack (see StackVM.h), for inlined pushes and pops.
+    stackTy = StructType::getTypeByName(context, "Stack");
+    if (!stackTy)
+        stackTy = StructType::create(context, {PointerType::getUnqual(Type::getInt32Ty(context)),
+                                               Type::getInt32Ty(context), Type::getInt32Ty(context),
+                                               Type::getInt32Ty(context)},
+                                     "Stack");
+}
+
+// Helper: the address of ctx->fuel. Like the layout of Stack, the offset of the field is part of
+// the runtime ABI.
+static Value *fuelPointer(IRBuilderBase &builder, Value *ctx) {
+    LLVMContext &context = builder.getContext();
+    Value *field = builder.CreateConstInBoundsGEP1_64(Type::getInt8Ty(context), ctx,
+                                                      offsetof(piet_ctx, fuel));
+    return builder.CreateBitCast(field, PointerType::getUnqual(Type::getInt64Ty(context)));
+}
+
+// Helper: returns true if an edge from node `from` to target is a back edge. All the edges of a
+// node to the same target are examined at the same point of the search, so they agree.
+static bool isBackEdge(const Graph &graph, const std::vector<bool> &backEdges, int from, int target) {
+    uint32_t first = graph.getNode(from).firstEdge;
+    EdgeRange transitions = graph.getTransitions(from);
+    for (size_t j = 0; j < transitions.size(); ++j)
+        if (static_cast<int>(transitions[j].targetNode) == target)
+            return backEdges[first + j];
+    return false;
+}
+
+BasicBlock *IRGenerator::edgeTarget(const Graph &graph, int from, int target, BasicBlock *targetBB,
+                                    Value *ctx, std::map<int, BasicBlock*> &checks,
+                                    BasicBlock *&outOfFuel, int outOfFuelStatus) {
+    if (fuel == 0 || !isBackEdge(graph, backEdges, from, target))
+        return targetBB;
+    BasicBlock *&check = checks[target];
+    if (check)
+        return check;
+    Function *func = targetBB->getParent();
+    Type *i64Ty = Type::getInt64Ty(context);
+    if (!outOfFuel) {
+        outOfFuel = BasicBlock::Create(context, "out_of_fuel", func);
+        IRBuilder<> exitBuilder(outOfFuel);
+        exitBuilder.CreateRet(ConstantInt::get(Type::getInt32Ty(context), outOfFuelStatus));
+    }
+    check = BasicBlock::Create(context, "fuel" + std::to_string(from) + "_" + std::to_string(target),
+                               func);
+    IRBuilder<> builder(check);
+    Value *pointer = fuelPointer(builder, ctx);
+    Value *left = builder.CreateSub(builder.CreateLoad(i64Ty, pointer), ConstantInt::get(i64Ty, 1));
+    builder.CreateStore(left, pointer);
+    builder.CreateCondBr(builder.CreateICmpSLT(left, ConstantInt::get(i64Ty, 0)), outOfFuel, targetBB);
+    return check;
+}
+
+Value *IRGenerator::emitPrepareStack(IRBuilderBase &builder, Value *ctx, const Graph &graph) {
+    Value *stack;
+    if (useGuardedStack) {
+        stack = builder.CreateCall(prepareGuardedStackF, { ctx });
+    } else {
+        int capacity = uncheckedPush ? preallocatedDepth : 0;
+        stack = builder.CreateCall(prepareStackF,
+                                   { ctx, ConstantInt::get(Type::getInt32Ty(context), capacity) });
+    }
+    if (trace)
+        builder.CreateCall(traceStartF, { ConstantInt::get(Type::getInt32Ty(context), graph.size()) });
+    if (fuel > 0)
+        builder.CreateStore(ConstantInt::get(Type::getInt64Ty(context), fuel), fuelPointer(builder, ctx));
+
+    // The output and stack of the prefix evaluated at compile time, as constants.
+    Module *module = builder.GetInsertBlock()->getModule();
+    Type *i32Ty = Type::getInt32Ty(context);
+    Type *bytePtrTy = PointerType::getUnqual(Type::getInt8Ty(context));
+    if (!initialOutput.empty()) {
+        Constant *bytes = ConstantDataArray::getString(context, initialOutput, /*AddNull=*/false);
+        auto *global = new GlobalVariable(*module, bytes->getType(), true, GlobalValue::PrivateLinkage,
+                                          bytes, "prefix_output");
+        builder.CreateCall(writeOutputF, { ctx, builder.CreateBitCast(global, bytePtrTy),
+                                           ConstantInt::get(i32Ty, initialOutput.size()) });
+    }
+    if (!initialStack.empty()) {
+        std::vector<uint32_t> values(initialStack.begin(), initialStack.end());
+        Constant *array = ConstantDataArray::get(context, values);
+        auto *global = new GlobalVariable(*module, array->getType(), true, GlobalValue::PrivateLinkage,
+                                          array, "prefix_stack");
+        builder.CreateCall(stackLoadF, { stack, builder.CreateBitCast(global, PointerType::getUnqual(i32Ty)),
+                                         ConstantInt::get(i32Ty, initialStack.size()) });
+    }
+    return stack;
+}
+
+void IRGenerator::emitTrace(IRBuilderBase &builder, Value *stack, const Graph &graph, int id) {
+    if (!trace)
+        return;
+    EdgeRange transitions = graph.getTransitions(id);
+    Command cmd = transitions.empty() ? Command::None : transitions[0].command;
+    builder.CreateCall(traceF, { stack, ConstantInt::get(Type::getInt32Ty(context), id),
+                                 ConstantInt::get(Type::getInt32Ty(context), static_cast<int>(cmd)) });
+}
+
+Value *IRGenerator::emitPop(IRBuilderBase &builder, Value *stack, bool unchecked) {
+    if (!unchecked)
+        return builder.CreateCall(stackPopF, { stack });
+    Type *i32Ty = Type::getInt32Ty(context);
+    Value *s = builder.CreateBitCast(stack, PointerType::getUnqual(stackTy));
+    Value *sizePtr = builder.CreateStructGEP(stackTy, s, 1);
+    Value *size = builder.CreateSub(builder.CreateLoad(i32Ty, sizePtr), ConstantInt::get(i32Ty, 1));
+    builder.CreateStore(size, sizePtr);
+    Value *data = builder.CreateLoad(stackTy->getElementType(0), builder.CreateStructGEP(stackTy, s, 0));
+    return builder.CreateLoad(i32Ty, builder.CreateInBoundsGEP(i32Ty, data, size));
+}
+
+void IRGenerator::emitPush(IRBuilderBase &builder, Value *stack, Value *value) {
+    if (!uncheckedPush) {
+        builder.CreateCall(stackPushF, { stack, value });
+        return;
+    }
+    Type *i32Ty = Type::getInt32Ty(context);
+    Value *s = builder.CreateBitCast(stack, PointerType::getUnqual(stackTy));
+    Value *sizePtr = builder.CreateStructGEP(stackTy, s, 1);
+    Value *size = builder.CreateLoad(i32Ty, sizePtr);
+    Value *data = builder.CreateLoad(stackTy->getElementType(0), builder.CreateStructGEP(stackTy, s, 0));
+    builder.CreateStore(value, builder.CreateInBoundsGEP(i32Ty, data, size));
+    builder.CreateStore(builder.CreateAdd(size, ConstantInt::get(i32Ty, 1)), sizePtr);
+}
+
+void IRGenerator::emitNode(IRBuilderBase &builder, const GraphNode &node, EdgeRange transitions,
+                           const DepthInterval &depth, Value *stackInst, Value *ctx,
+                           const std::function<BasicBlock*(int)> &successor,
+                           const std::function<void()> &terminate) {
+    // The k-th pop of this node cannot underflow if the entry depth is always at least k.
+    int popped = 0;
+    auto pop = [&]() { return emitPop(builder, stackInst, depth.reachable() && depth.lo > popped++); };
+
+    // Now, branch based on outgoing transitions.
+    if (transitions.empty()) {
+        // Terminal state.
+        terminate();
+    } else if (transitions.size() == 1) {
+        // Single transition: execute the command associated with the edge.
+        Command cmd = transitions[0].command;
+        // For arithmetic commands we simulate inline operations (this is similar to previous IR generation).
+        switch (cmd) {
+            case Command::Push: {
+                emitPush(builder, stackInst, ConstantInt::get(Type::getInt32Ty(context), node.blockSize));
+                break;
+            }
+            case Command::Pop: {
+                pop();
+                break;
+            }
+            case Command::Add: {
+                Value *a = pop();
+                Value *b = pop();
+                Value *sum = builder.CreateAdd(a, b);
+                emitPush(builder, stackInst, sum);
+                break;
+            }
+            case Command::Subtract: {
+                Value *a = pop();
+                Value *b = pop();
+                Value *diff = builder.CreateSub(b, a);
+                emitPush(builder, stackInst, diff);
+                break;
+            }
+            case Command::Multiply: {
+                Value *a = pop();
+                Value *b = pop();
+                Value *prod = builder.CreateMul(a, b);
+                emitPush(builder, stackInst, prod);
+                break;
+            }
+            case Command::Divide: {
+                Value *a = pop();
+                Value *b = pop();
+                Value *quot = builder.CreateSDiv(b, a);
+                emitPush(builder, stackInst, quot);
+                break;
+            }
+            case Command::Modulo: {
+                Value *a = pop();
+                Value *b = pop();
+                Value *rem = builder.CreateSRem(b, a);
+                emitPush(builder, stackInst, rem);
+                break;
+            }
+            case Command::Not: {
+                Value *a = pop();
+                Value *cmp = builder.CreateICmpEQ(a, ConstantInt::get(Type::getInt32Ty(context), 0));
+                Value *result = builder.CreateSelect(cmp,
+                                         ConstantInt::get(Type::getInt32Ty(context), 1),
+                                         ConstantInt::get(Type::getInt32Ty(context), 0));
+                emitPush(builder, stackInst, result);
+                break;
+            }
+            case Command::Greater: {
+                Value *a = pop();
+                Value *b = pop();
+                Value *cmp = builder.CreateICmpSGT(b, a);
+                Value *result = builder.CreateSelect(cmp,
+                                         ConstantInt::get(Type::getInt32Ty(context), 1),
+                                         ConstantInt::get(Type::getInt32Ty(context), 0));
+                emitPush(builder, stackInst, result);
+                break;
+            }
+            case Command::Duplicate: {
+                Value *top = pop();
+                emitPush(builder, stackInst, top);
+                emitPush(builder, stackInst, top);
+                break;
+            }
+            case Command::Roll: {
+                Value *rolls = pop();
+                Value *depth = pop();
+                builder.CreateCall(stackRollF, { stackInst, rolls, depth });
+                break;
+            }
+            case Command::InputNum: {
+                builder.CreateCall(inputNumF, { ctx });
+                break;
+            }
+            case Command::InputChar: {
+                builder.CreateCall(inputCharF, { ctx });
+                break;
+            }
+            case Command::OutputNum: {
+                Value *num = pop();
+                builder.CreateCall(outputNumF, { ctx, num });
+                break;
+            }
+            case Command::OutputChar: {
+                Value *ch = pop();
+                builder.CreateCall(outputCharF, { ctx, ch });
+                break;
+            }
+            default:
+                break;
+        }
+        // Unconditional branch to the sole successor.
+        builder.CreateBr(successor(transitions[0].targetNode));
+    } else {
+        // Multiple transitions: pop an integer from the stack and use it to choose the branch.
+        Value *choice = pop();
+        // For safety, compute modulo (#edges) by using an unsigned remainder.
+        int numEdges = transitions.size();
+        Value *modVal = ConstantInt::get(Type::getInt32Ty(context), numEdges);
+        Value *index = builder.CreateURem(choice, modVal, "choiceIndex");
+
+        // Create a switch instruction that branches to each target basic block.
+        BasicBlock *defaultBB = successor(transitions[0].targetNode); // arbitrary default.
+        SwitchInst *swInst = builder.CreateSwitch(index, defaultBB, numEdges);
+        for (unsigned j = 0; j < transitions.size(); j++) {
+            int tgt = transitions[j].targetNode;
+            swInst->addCase(ConstantInt::get(Type::getInt32Ty(context), j), successor(tgt));
+        }
+        // (In a full implementation, the command would be executed as part of each transition.)
+    }
+}
+
+Function *IRGenerator::generateSingleFunction(Module *module, const Graph &graph) {
+    IRBuilder<> builder(context);
+
+    // Create the entry function: int piet_run(piet_ctx *ctx)
+    PointerType *ctxPtrTy = PointerType::getUnqual(Type::getInt8Ty(context));
+    FunctionType *runType = FunctionType::get(Type::getInt32Ty(context), {ctxPtrTy}, false);
+    Function *runFunc = Function::Create(runType, Function::ExternalLinkage, "piet_run", module);
+    Value *ctx = runFunc->getArg(0);
+    BasicBlock *entryBB = BasicBlock::Create(context, "entry", runFunc);
     builder.SetInsertPoint(entryBB);
 
-    // Create the runtime stack.
-    CallInst *stackInst = builder.CreateCall(createStackF, {});
+    // Get the runtime stack.
+    Value *stackInst = emitPrepareStack(builder, ctx, graph);
 
-    // Retrieve the execution graph.
-    const std::vector<GraphNode>& nodes = graph.getNodes();
-    if (nodes.empty()) {
+    if (graph.empty()) {
         builder.CreateRet(ConstantInt::get(Type::getInt32Ty(context), 0));
-        return module;
+        return runFunc;
     }
 
     // Create a basic block for each graph node.
     std::vector<BasicBlock*> bbNodes;
-    for (size_t i = 0; i < nodes.size(); ++i) {
-        bbNodes.push_back(BasicBlock::Create(context, "node" + std::to_string(i), mainFunc));
+    for (size_t i = 0; i < graph.size(); ++i) {
+        bbNodes.push_back(BasicBlock::Create(context, "node" + std::to_string(i), runFunc));
     }
 
     // Branch from entry to the initial node.
     builder.CreateBr(bbNodes[0]);
 
     // For each node, generate code.
-    for (size_t i = 0; i < nodes.size(); ++i) {
+    BasicBlock *outOfFuel = nullptr;
+    for (size_t i = 0; i < graph.size(); ++i) {
         builder.SetInsertPoint(bbNodes[i]);
-        const GraphNode &node = nodes[i];
-        
-        // Now, branch based on outgoing transitions.
-        if (node.transitions.empty()) {
-            // Terminal state: destroy stack and return.
-            builder.CreateCall(destroyStackF, { stackInst });
-            builder.CreateRet(ConstantInt::get(Type::getInt32Ty(context), 0));
-        } else if (node.transitions.size() == 1) {
-            // Single transition: execute the command associated with the edge.
-            Command cmd = node.transitions[0].command;
-            // For arithmetic commands we simulate inline operations (this is similar to previous IR generation).
-            switch (cmd) {
-                case Command::Push: {
-                    builder.CreateCall(stackPushF,
-                        { stackInst, ConstantInt::get(Type::getInt32Ty(context), node.blockSize) });
-                    break;
-                }
-                case Command::Pop: {
-                    builder.CreateCall(stackPopF, { stackInst });
-                    break;
-                }
-                case Command::Add: {
-                    Value *a = builder.CreateCall(stackPopF, { stackInst });
-                    Value *b = builder.CreateCall(stackPopF, { stackInst });
-                    Value *sum = builder.CreateAdd(a, b);
-                    builder.CreateCall(stackPushF, { stackInst, sum });
-                    break;
-                }
-                case Command::Subtract: {
-                    Value *a = builder.CreateCall(stackPopF, { stackInst });
-                    Value *b = builder.CreateCall(stackPopF, { stackInst });
-                    Value *diff = builder.CreateSub(b, a);
-                    builder.CreateCall(stackPushF, { stackInst, diff });
-                    break;
-                }
-                case Command::Multiply: {
-                    Value *a = builder.CreateCall(stackPopF, { stackInst });
-                    Value *b = builder.CreateCall(stackPopF, { stackInst });
-                    Value *prod = builder.CreateMul(a, b);
-                    builder.CreateCall(stackPushF, { stackInst, prod });
-                    break;
-                }
-                case Command::Divide: {
-                    Value *a = builder.CreateCall(stackPopF, { stackInst });
-                    Value *b = builder.CreateCall(stackPopF, { stackInst });
-                    Value *quot = builder.CreateSDiv(b, a);
-                    builder.CreateCall(stackPushF, { stackInst, quot });
-                    break;
-                }
-                case Command::Modulo: {
-                    Value *a = builder.CreateCall(stackPopF, { stackInst });
-                    Value *b = builder.CreateCall(stackPopF, { stackInst });
-                    Value *rem = builder.CreateSRem(b, a);
-                    builder.CreateCall(stackPushF, { stackInst, rem });
-                    break;
-                }
-                case Command::Not: {
-                    Value *a = builder.CreateCall(stackPopF, { stackInst });
-                    Value *cmp = builder.CreateICmpEQ(a, ConstantInt::get(Type::getInt32Ty(context), 0));
-                    Value *result = builder.CreateSelect(cmp,
-                                             ConstantInt::get(Type::getInt32Ty(context), 1),
-                                             ConstantInt::get(Type::getInt32Ty(context), 0));
-                    builder.CreateCall(stackPushF, { stackInst, result });
-                    break;
-                }
-                case Command::Greater: {
-                    Value *a = builder.CreateCall(stackPopF, { stackInst });
-                    Value *b = builder.CreateCall(stackPopF, { stackInst });
-                    Value *cmp = builder.CreateICmpSGT(b, a);
-                    Value *result = builder.CreateSelect(cmp,
-                                             ConstantInt::get(Type::getInt32Ty(context), 1),
-                                             ConstantInt::get(Type::getInt32Ty(context), 0));
-                    builder.CreateCall(stackPushF, { stackInst, result });
-                    break;
-                }
-                case Command::Duplicate: {
-                    Value *top = builder.CreateCall(stackPopF, { stackInst });
-                    builder.CreateCall(stackPushF, { stackInst, top });
-                    builder.CreateCall(stackPushF, { stackInst, top });
-                    break;
-                }
-                case Command::Roll: {
-                    Value *rolls = builder.CreateCall(stackPopF, { stackInst });
-                    Value *depth = builder.CreateCall(stackPopF, { stackInst });
-                    builder.CreateCall(stackRollF, { stackInst, rolls, depth });
-                    break;
+        emitTrace(builder, stackInst, graph, i);
+        std::map<int, BasicBlock*> checks;
+        emitNode(builder, graph.getNode(i), graph.getTransitions(i), depthBounds[i], stackInst, ctx,
+                 [&](int target) {
+                     return edgeTarget(graph, i, target, bbNodes[target], ctx, checks, outOfFuel,
+                                       PIET_OUT_OF_FUEL);
+                 },
+                 [&]() {
+                     // Terminal state: return (the stack stays with the context).
+                     builder.CreateRet(ConstantInt::get(Type::getInt32Ty(context), 0));
+                 });
+    }
+    return runFunc;
+}
+
+void IRGenerator::generateMain(Module *module, Function *run) {
+    IRBuilder<> builder(context);
+    FunctionType *mainType = FunctionType::get(Type::getInt32Ty(context), false);
+    Function *mainFunc = Function::Create(mainType, Function::ExternalLinkage, "main", module);
+    builder.SetInsertPoint(BasicBlock::Create(context, "entry", mainFunc));
+    Value *ctx = builder.CreateCall(createStdioContextF, {});
+    Value *status = builder.CreateCall(run, { ctx });
+    builder.CreateCall(destroyContextF, { ctx });
+    builder.CreateRet(status);
+}
+
+std::vector<int> partitionGraph(const Graph &graph, int maxRegionNodes) {
+    int n = graph.size();
+    // Iterative Tarjan's algorithm. Components are completed in reverse topological order.
+    std::vector<int> index(n, -1), low(n, 0), comp(n, -1);
+    std::vector<bool> onStack(n, false);
+    std::vector<int> sccStack;
+    std::vector<std::pair<int, size_t>> callStack; // (node, next edge to visit)
+    std::vector<int> compSize;
+    int counter = 0;
+    for (int root = 0; root < n; ++root) {
+        if (index[root] >= 0)
+            continue;
+        index[root] = low[root] = counter++;
+        sccStack.push_back(root);
+        onStack[root] = true;
+        callStack.push_back({root, 0});
+        while (!callStack.empty()) {
+            int v = callStack.back().first;
+            size_t edge = callStack.back().second++;
+            EdgeRange transitions = graph.getTransitions(v);
+            if (edge < transitions.size()) {
+                int w = transitions[edge].targetNode;
+                if (index[w] < 0) {
+                    index[w] = low[w] = counter++;
+                    sccStack.push_back(w);
+                    onStack[w] = true;
+                    callStack.push_back({w, 0});
+                } else if (onStack[w]) {
+                    low[v] = std::min(low[v], index[w]);
                 }
-                case Command::OutputChar: {
-                    Value *ch = builder.CreateCall(stackPopF, { stackInst });
-                    builder.CreateCall(putcharF, { builder.CreateIntCast(ch, Type::getInt32Ty(context), false) });
-                    break;
+                continue;
+            }
+            // All successors of v are done.
+            if (low[v] == index[v]) {
+                int size = 0;
+                int w;
+                do {
+                    w = sccStack.back();
+                    sccStack.pop_back();
+                    onStack[w] = false;
+                    comp[w] = compSize.size();
+                    ++size;
+                } while (w != v);
+                compSize.push_back(size);
+            }
+            callStack.pop_back();
+            if (!callStack.empty()) {
+                int parent = callStack.back().first;
+                low[parent] = std::min(low[parent], low[v]);
+            }
+        }
+    }
+
+    // Walk the components in topological order and pack them into regions.
+    int numComps = compSize.size();
+    std::vector<int> compRegion(numComps, 0);
+    int region = -1, regionNodes = 0;
+    for (int c = numComps - 1; c >= 0; --c) {
+        if (region < 0 || regionNodes + compSize[c] > maxRegionNodes) {
+            ++region;
+            regionNodes = 0;
+        }
+        compRegion[c] = region;
+        regionNodes += compSize[c];
+    }
+    std::vector<int> nodeRegion(n);
+    for (int i = 0; i < n; ++i)
+        nodeRegion[i] = compRegion[comp[i]];
+    return nodeRegion;
+}
+
+std::vector<bool> findBackEdges(const Graph &graph) {
+    int n = graph.size();
+    std::vector<bool> backEdges(graph.numEdges(), false);
+    // 0: not visited, 1: on the search path, 2: done.
+    std::vector<uint8_t> state(n, 0);
+    std::vector<std::pair<int, size_t>> callStack; // (node, next edge to visit)
+    for (int root = 0; root < n; ++root) {
+        if (state[root] != 0)
+            continue;
+        state[root] = 1;
+        callStack.push_back({root, 0});
+        while (!callStack.empty()) {
+            int v = callStack.back().first;
+            size_t edge = callStack.back().second++;
+            EdgeRange transitions = graph.getTransitions(v);
+            if (edge < transitions.size()) {
+                int w = transitions[edge].targetNode;
+                if (state[w] == 0) {
+                    state[w] = 1;
+                    callStack.push_back({w, 0});
+                } else if (state[w] == 1) {
+                    backEdges[graph.getNode(v).firstEdge + edge] = true;
                 }
-                default:
-                    break;
-            }
-            // Unconditional branch to the sole successor.
-            builder.CreateBr(bbNodes[node.transitions[0].targetNode]);
-        } else {
-            // Multiple transitions: pop an integer from the stack and use it to choose the branch.
-            Value *choice = builder.CreateCall(stackPopF, { stackInst });
-            // For safety, compute modulo (#edges) by using an unsigned remainder.
-            int numEdges = node.transitions.size();
-            Value *modVal = ConstantInt::get(Type::getInt32Ty(context), numEdges);
-            Value *index = builder.CreateURem(choice, modVal, "choiceIndex");
-
-            // Create a switch instruction that branches to each target basic block.
-            BasicBlock *defaultBB = bbNodes[node.transitions[0].targetNode]; // arbitrary default.
-            SwitchInst *swInst = builder.CreateSwitch(index, defaultBB, numEdges);
-            for (unsigned j = 0; j < node.transitions.size(); j++) {
-                int tgt = node.transitions[j].targetNode;
-                swInst->addCase(ConstantInt::get(Type::getInt32Ty(context), j), bbNodes[tgt]);
-            }
-            // (In a full implementation, the command would be executed as part of each transition.)
+                continue;
+            }
+            state[v] = 2;
+            callStack.pop_back();
         }
     }
-    // Verify the module.
-    verifyModule(*module, &errs());
+    return backEdges;
+}
+
+// Helper: whether each node is an entry of its region, i.e. control can arrive there from
+// outside it.
+static std::vector<bool> regionEntries(const Graph &graph, const std::vector<int> &nodeRegion) {
+    std::vector<bool> isEntry(graph.size(), false);
+    if (graph.empty())
+        return isEntry;
+    isEntry[0] = true;
+    for (size_t i = 0; i < graph.size(); ++i)
+        for (const auto &edge : graph.getTransitions(i))
+            if (nodeRegion[edge.targetNode] != nodeRegion[i])
+                isEntry[edge.targetNode] = true;
+    return isEntry;
+}
+
+FunctionType *IRGenerator::regionFunctionType() {
+    PointerType *stackPtrTy = PointerType::getUnqual(Type::getInt8Ty(context));
+    Type *i32Ty = Type::getInt32Ty(context);
+    return FunctionType::get(i32Ty, {stackPtrTy, stackPtrTy, i32Ty}, false);
+}
+
+void IRGenerator::emitRegion(Function *func, const Graph &graph, const std::vector<int> &nodeRegion,
+                             const std::vector<int> &regionNodes, const std::vector<bool> &isEntry,
+                             std::vector<BasicBlock*> &bbNodes) {
+    IRBuilder<> builder(context);
+    Type *i32Ty = Type::getInt32Ty(context);
+    int r = nodeRegion[regionNodes.front()];
+    Value *stackArg = func->getArg(0);
+    Value *ctxArg = func->getArg(1);
+    Value *entryArg = func->getArg(2);
+    BasicBlock *entryBB = BasicBlock::Create(context, "entry", func);
+    BasicBlock *badEntryBB = BasicBlock::Create(context, "bad_entry", func);
+    for (int id : regionNodes)
+        bbNodes[id] = BasicBlock::Create(context, "node" + std::to_string(id), func);
+
+    builder.SetInsertPoint(badEntryBB);
+    builder.CreateUnreachable();
+    builder.SetInsertPoint(entryBB);
+    SwitchInst *dispatch = builder.CreateSwitch(entryArg, badEntryBB);
+    for (int id : regionNodes)
+        if (isEntry[id])
+            dispatch->addCase(ConstantInt::get(Type::getInt32Ty(context), id), bbNodes[id]);
+
+    // Leaving the region returns the id of the node to continue from.
+    std::map<int, BasicBlock*> exits;
+    auto successor = [&](int target) -> BasicBlock* {
+        if (nodeRegion[target] == r)
+            return bbNodes[target];
+        BasicBlock *&exitBB = exits[target];
+        if (!exitBB) {
+            exitBB = BasicBlock::Create(context, "exit" + std::to_string(target), func);
+            IRBuilder<> exitBuilder(exitBB);
+            exitBuilder.CreateRet(ConstantInt::get(i32Ty, target));
+        }
+        return exitBB;
+    };
+    BasicBlock *outOfFuel = nullptr;
+    for (int id : regionNodes) {
+        builder.SetInsertPoint(bbNodes[id]);
+        emitTrace(builder, stackArg, graph, id);
+        std::map<int, BasicBlock*> checks;
+        emitNode(builder, graph.getNode(id), graph.getTransitions(id), depthBounds[id], stackArg,
+                 ctxArg,
+                 [&](int target) {
+                     return edgeTarget(graph, id, target, successor(target), ctxArg, checks,
+                                       outOfFuel, kRegionOutOfFuel);
+                 },
+                 [&]() { builder.CreateRet(ConstantInt::get(i32Ty, -1)); });
+    }
+}
+
+Function *IRGenerator::emitDispatch(Module *module, const Graph &graph,
+                                    const std::vector<int> &nodeRegion,
+                                    const std::vector<Constant*> &regionFuncs,
+                                    const std::string &name) {
+    IRBuilder<> builder(context);
+    Type *i32Ty = Type::getInt32Ty(context);
+    PointerType *stackPtrTy = PointerType::getUnqual(Type::getInt8Ty(context));
+    FunctionType *regionType = regionFunctionType();
+
+    // Lookup tables: the region of every node, and the function of every region.
+    std::vector<uint32_t> regionOfNode(nodeRegion.begin(), nodeRegion.end());
+    Constant *nodeRegionInit = ConstantDataArray::get(context, regionOfNode);
+    auto *nodeRegionTable = new GlobalVariable(*module, nodeRegionInit->getType(), true,
+                                               GlobalValue::InternalLinkage, nodeRegionInit,
+                                               "piet_node_region");
+    ArrayType *funcTableTy = ArrayType::get(PointerType::getUnqual(regionType), regionFuncs.size());
+    auto *funcTable = new GlobalVariable(*module, funcTableTy, true, GlobalValue::InternalLinkage,
+                                         ConstantArray::get(funcTableTy, regionFuncs),
+                                         "piet_regions");
+
+    // int piet_run(piet_ctx *ctx): get the stack, then call region functions until the program
+    // terminates.
+    FunctionType *runType = FunctionType::get(i32Ty, {stackPtrTy}, false);
+    Function *runFunc = Function::Create(runType, Function::ExternalLinkage, name, module);
+    Value *ctx = runFunc->getArg(0);
+    BasicBlock *entryBB = BasicBlock::Create(context, "entry", runFunc);
+    BasicBlock *loopBB = BasicBlock::Create(context, "dispatch", runFunc);
+    BasicBlock *doneBB = BasicBlock::Create(context, "done", runFunc);
+
+    builder.SetInsertPoint(entryBB);
+    Value *stackInst = emitPrepareStack(builder, ctx, graph);
+    builder.CreateBr(loopBB);
+
+    builder.SetInsertPoint(loopBB);
+    PHINode *current = builder.CreatePHI(i32Ty, 2, "node");
+    current->addIncoming(ConstantInt::get(i32Ty, 0), entryBB);
+    Value *zero = ConstantInt::get(i32Ty, 0);
+    Value *regionIdx = builder.CreateLoad(i32Ty,
+        builder.CreateInBoundsGEP(nodeRegionInit->getType(), nodeRegionTable, {zero, current}));
+    Value *func = builder.CreateLoad(funcTableTy->getElementType(),
+        builder.CreateInBoundsGEP(funcTableTy, funcTable, {zero, regionIdx}));
+    Value *next = builder.CreateCall(regionType, func, {stackInst, ctx, current}, "next");
+    current->addIncoming(next, loopBB);
+    builder.CreateCondBr(builder.CreateICmpSLT(next, zero), doneBB, loopBB);
+
+    builder.SetInsertPoint(doneBB);
+    if (fuel > 0) {
+        Value *outOfFuel = builder.CreateICmpEQ(next, ConstantInt::get(i32Ty, kRegionOutOfFuel));
+        builder.CreateRet(builder.CreateSelect(outOfFuel, ConstantInt::get(i32Ty, PIET_OUT_OF_FUEL), zero));
+    } else {
+        builder.CreateRet(zero);
+    }
+    return runFunc;
+}
+
+Function *IRGenerator::generatePartitioned(Module *module, const Graph &graph) {
+    std::vector<int> nodeRegion = partitionGraph(graph, kMaxRegionNodes);
+    int numRegions = *std::max_element(nodeRegion.begin(), nodeRegion.end()) + 1;
+    std::vector<std::vector<int>> regionNodes(numRegions);
+    for (size_t i = 0; i < graph.size(); ++i)
+        regionNodes[nodeRegion[i]].push_back(i);
+    std::vector<bool> isEntry = regionEntries(graph, nodeRegion);
+
+    // Each region becomes a function "i32 piet_regionN(i8* stack, i8* ctx, i32 entryNode)". It runs
+    // until control leaves the region and returns the next node id, or -1 once the program
+    // terminates.
+    std::vector<Constant*> regionFuncs;
+    std::vector<BasicBlock*> bbNodes(graph.size(), nullptr);
+    for (int r = 0; r < numRegions; ++r) {
+        Function *func = Function::Create(regionFunctionType(), Function::InternalLinkage,
+                                          "piet_region" + std::to_string(r), module);
+        regionFuncs.push_back(func);
+        emitRegion(func, graph, nodeRegion, regionNodes[r], isEntry, bbNodes);
+    }
+    return emitDispatch(module, graph, nodeRegion, regionFuncs, "piet_run");
+}
+
+void IRGenerator::analyzeGraph(const Graph &graph) {
+    backEdges = fuel > 0 ? findBackEdges(graph) : std::vector<bool>();
+
+    // Bound the stack depth: pops that cannot underflow and, if the whole program has a small
+    // enough maximum depth or runs on a guarded stack, every push are inlined without checks.
+    depthBounds = computeStackBounds(graph, initialStack.size());
+    int maxDepth = maxStackDepth(graph, depthBounds);
+    bool bounded = maxDepth <= kMaxPreallocatedDepth;
+    useGuardedStack = guardedStack && !bounded;
+    uncheckedPush = bounded || useGuardedStack;
+    preallocatedDepth = bounded ? maxDepth : 0;
+}
+
+// Helper: report a module that fails verification.
+static void verifyGenerated(const Module &module) {
+    std::string problems;
+    raw_string_ostream problemStream(problems);
+    if (verifyModule(module, &problemStream))
+        reportError("generated module is invalid: " + problemStream.str());
+}
+
+void IRGenerator::prepareRegions(const Graph &graph) {
+    analyzeGraph(graph);
+}
+
+Module *IRGenerator::generateRegion(const Graph &graph, const std::vector<int> &nodeRegion, int region,
+                                    const std::string &name) {
+    std::vector<int> regionNodes;
+    for (size_t id = 0; id < graph.size(); ++id)
+        if (nodeRegion[id] == region)
+            regionNodes.push_back(id);
+    std::vector<bool> isEntry(graph.size(), true);
+    std::vector<BasicBlock*> bbNodes(graph.size(), nullptr);
+
+    Module *module = new Module(name, context);
+    declareRuntime(module);
+    Function *func = Function::Create(regionFunctionType(), Function::ExternalLinkage, name, module);
+    emitRegion(func, graph, nodeRegion, regionNodes, isEntry, bbNodes);
+    verifyGenerated(*module);
+    return module;
+}
+
+Module *IRGenerator::generateIncremental(const Graph &graph, int regionSize, const std::string &runName,
+                                         const std::function<bool(const std::string&)> &haveRegion,
+                                         std::vector<std::unique_ptr<Module>> &regionModules) {
+    analyzeGraph(graph);
+    std::vector<int> nodeRegion(graph.size());
+    for (size_t i = 0; i < graph.size(); ++i)
+        nodeRegion[i] = i / regionSize;
+    int numRegions = graph.empty() ? 0 : nodeRegion.back() + 1;
+    std::vector<bool> isEntry = regionEntries(graph, nodeRegion);
+
+    // Generate every region into a module of its own; its function is named after a hash of
+    // its code, so a region that generates the same code as before keeps its name.
+    std::vector<std::string> regionNames;
+    std::set<std::string> generated;
+    std::vector<BasicBlock*> bbNodes(graph.size(), nullptr);
+    for (int r = 0; r < numRegions; ++r) {
+        std::vector<int> nodesOfRegion;
+        for (size_t id = r * static_cast<size_t>(regionSize);
+             id < std::min(graph.size(), (r + 1) * static_cast<size_t>(regionSize)); ++id)
+            nodesOfRegion.push_back(id);
+        auto regionModule = std::make_unique<Module>("PietRegion", context);
+        declareRuntime(regionModule.get());
+        Function *func = Function::Create(regionFunctionType(), Function::ExternalLinkage,
+                                          "piet_region", regionModule.get());
+        emitRegion(func, graph, nodeRegion, nodesOfRegion, isEntry, bbNodes);
+        std::string code;
+        raw_string_ostream codeStream(code);
+        func->print(codeStream);
+        std::string name = "piet_region_" + utohexstr(xxHash64(codeStream.str()), /*LowerCase=*/true);
+        regionNames.push_back(name);
+        if (haveRegion(name) || !generated.insert(name).second)
+            continue;
+        func->setName(name);
+        regionModule->setModuleIdentifier(name);
+        verifyGenerated(*regionModule);
+        regionModules.push_back(std::move(regionModule));
+    }
+
+    // The entry point calls the region functions by name.
+    Module *module = new Module("PietModule", context);
+    declareRuntime(module);
+    std::vector<Constant*> regionFuncs;
+    for (const std::string &name : regionNames)
+        regionFuncs.push_back(Function::Create(regionFunctionType(), Function::ExternalLinkage,
+                                               name, module));
+    if (graph.empty()) {
+        IRBuilder<> builder(context);
+        FunctionType *runType = FunctionType::get(Type::getInt32Ty(context),
+                                                  {PointerType::getUnqual(Type::getInt8Ty(context))},
+                                                  false);
+        Function *runFunc = Function::Create(runType, Function::ExternalLinkage, runName, module);
+        builder.SetInsertPoint(BasicBlock::Create(context, "entry", runFunc));
+        builder.CreateRet(ConstantInt::get(Type::getInt32Ty(context), 0));
+    } else {
+        emitDispatch(module, graph, nodeRegion, regionFuncs, runName);
+    }
+    verifyGenerated(*module);
+    return module;
+}
+
+Module* IRGenerator::generateModule(const Graph &graph) {
+    Module *module = new Module("PietModule", context);
+    analyzeGraph(graph);
+
+    // Declare external runtime functions.
+    declareRuntime(module);
+
+    bool partition = partitionThreshold >= 0 && !graph.empty() &&
+                     graph.size() >= static_cast<size_t>(partitionThreshold);
+    Function *run = partition ? generatePartitioned(module, graph)
+                              : generateSingleFunction(module, graph);
+    generateMain(module, run);
+    verifyGenerated(*module);
     return module;
 }
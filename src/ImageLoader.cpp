@@ -1,20 +1,41 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include "ImageLoader.h"
-#include <iostream>
+#include "Diagnostics.h"
+#include <climits>
+
+// Helper: take ownership of pixel data decoded by stb_image.
+static void adoptPixels(unsigned char *data, int w, int h, Image &image) {
+    image.width = w;
+    image.height = h;
+    image.channels = 3;
+    image.data.assign(data, data + w * h * 3);
+    stbi_image_free(data);
+}
 
 bool loadImage(const std::string &filename, Image &image) {
     int w, h, channels;
     // Force 3 channels (RGB) regardless of image type.
     unsigned char *data = stbi_load(filename.c_str(), &w, &h, &channels, 3);
     if (!data) {
-        std::cerr << "Error: Cannot load image: " << filename << "\n";
+        reportError("Cannot load image: " + filename);
         return false;
     }
-    image.width = w;
-    image.height = h;
-    image.channels = 3;
-    image.data.assign(data, data + w * h * 3);
-    stbi_image_free(data);
+    adoptPixels(data, w, h, image);
+    return true;
+}
+
+bool loadImageFromMemory(const uint8_t *buffer, size_t size, Image &image) {
+    if (size > INT_MAX) {
+        reportError("image buffer too large");
+        return false;
+    }
+    int w, h, channels;
+    unsigned char *data = stbi_load_from_memory(buffer, static_cast<int>(size), &w, &h, &channels, 3);
+    if (!data) {
+        reportError("Cannot decode image buffer");
+        return false;
+    }
+    adoptPixels(data, w, h, image);
     return true;
 }
@@ -0,0 +1,195 @@
+#include "JITProgram.h"
+#include "Graph.h"
+#include "IRBuilder.h"
+#include "ObjectEmitter.h"
+#include "PietTrace.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/Support/Error.h"
+#include <set>
+
+using namespace llvm;
+
+JITProgram::~JITProgram() = default;
+
+// Helper: report an LLVM error and consume it. Returns true if there was one.
+static bool reportIfError(Error error) {
+    if (!error)
+        return false;
+    reportError(toString(std::move(error)));
+    return true;
+}
+
+std::unique_ptr<orc::LLJIT> createProgramJIT() {
+    Expected<std::unique_ptr<orc::LLJIT>> created = orc::LLJITBuilder().create();
+    if (!created) {
+        reportIfError(created.takeError());
+        return nullptr;
+    }
+    std::unique_ptr<orc::LLJIT> jit = std::move(*created);
+
+    orc::MangleAndInterner mangle(jit->getExecutionSession(), jit->getDataLayout());
+    auto symbol = [](auto *function) {
+        return JITEvaluatedSymbol(pointerToJITTargetAddress(function), JITSymbolFlags::Exported);
+    };
+    orc::SymbolMap runtime;
+    runtime[mangle("stackPush")] = symbol(&stackPush);
+    runtime[mangle("stackPop")] = symbol(&stackPop);
+    runtime[mangle("stackRoll")] = symbol(&stackRoll);
+    runtime[mangle("stackLoad")] = symbol(&stackLoad);
+    runtime[mangle("pietPrepareStack")] = symbol(&pietPrepareStack);
+    runtime[mangle("pietPrepareGuardedStack")] = symbol(&pietPrepareGuardedStack);
+    runtime[mangle("pietWriteOutput")] = symbol(&pietWriteOutput);
+    runtime[mangle("pietCreateStdioContext")] = symbol(&pietCreateStdioContext);
+    runtime[mangle("pietDestroyContext")] = symbol(&pietDestroyContext);
+    runtime[mangle("pietInputChar")] = symbol(&pietInputChar);
+    runtime[mangle("pietInputNum")] = symbol(&pietInputNum);
+    runtime[mangle("pietOutputChar")] = symbol(&pietOutputChar);
+    runtime[mangle("pietOutputNum")] = symbol(&pietOutputNum);
+    runtime[mangle("pietTraceStart")] = symbol(&pietTraceStart);
+    runtime[mangle("pietTrace")] = symbol(&pietTrace);
+    orc::JITDylib &dylib = jit->getMainJITDylib();
+    if (reportIfError(dylib.define(orc::absoluteSymbols(std::move(runtime)))))
+        return nullptr;
+    auto processSymbols = orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+        jit->getDataLayout().getGlobalPrefix());
+    if (!processSymbols) {
+        reportIfError(processSymbols.takeError());
+        return nullptr;
+    }
+    dylib.addGenerator(std::move(*processSymbols));
+    return jit;
+}
+
+std::unique_ptr<JITProgram> JITProgram::compileFile(const std::string &inputFile,
+                                                    const CompileOptions &options) {
+    Graph graph;
+    if (!loadProgramGraph(inputFile, options, graph))
+        return nullptr;
+    return compileGraph(graph, options);
+}
+
+std::unique_ptr<JITProgram> JITProgram::compileGraph(const Graph &graph,
+                                                     const CompileOptions &options) {
+    initializeHostTarget();
+    auto context = std::make_unique<LLVMContext>();
+    std::unique_ptr<Module> module = generateModule(graph, options, *context);
+
+    std::unique_ptr<JITProgram> program(new JITProgram());
+    program->jit = createProgramJIT();
+    if (!program->jit)
+        return nullptr;
+    orc::LLJIT &jit = *program->jit;
+
+    if (reportIfError(jit.addIRModule(orc::ThreadSafeModule(std::move(module), std::move(context)))))
+        return nullptr;
+    Expected<JITEvaluatedSymbol> run = jit.lookup("piet_run");
+    if (!run) {
+        reportIfError(run.takeError());
+        return nullptr;
+    }
+    program->run = jitTargetAddressToFunction<piet_run_fn>(run->getAddress());
+    return program;
+}
+
+std::string JITProgram::runOnInput(const char *input, size_t size) const {
+    piet_ctx *ctx = pietCreateContext(input, size);
+    run(ctx);
+    std::string output(ctx->output ? ctx->output : "", ctx->outputSize);
+    pietDestroyContext(ctx);
+    return output;
+}
+
+// Region functions hold this many consecutive node ids. Since updates keep the ids of unchanged
+// states, an edit usually changes the code of a few regions only.
+static const int kIncrementalRegionNodes = 256;
+
+IncrementalProgram::~IncrementalProgram() = default;
+
+std::unique_ptr<IncrementalProgram> IncrementalProgram::create(const CompileOptions &options) {
+    initializeHostTarget();
+    std::unique_ptr<IncrementalProgram> program(new IncrementalProgram());
+    program->options = options;
+    program->jit = createProgramJIT();
+    if (!program->jit)
+        return nullptr;
+    return program;
+}
+
+bool IncrementalProgram::update(const std::vector<std::vector<PietColor>> &newGrid) {
+    // Find the codels that changed; a grid of another shape is explored from scratch.
+    bool sameShape = !graph.empty() && newGrid.size() == grid.size();
+    CodelRect dirty;
+    for (size_t r = 0; sameShape && r < newGrid.size(); ++r) {
+        if (newGrid[r].size() != grid[r].size()) {
+            sameShape = false;
+            break;
+        }
+        for (size_t c = 0; c < newGrid[r].size(); ++c)
+            if (newGrid[r][c] != grid[r][c])
+                dirty.add(r, c);
+    }
+    if (sameShape) {
+        stats.exploredStates = dirty.empty() ? 0 : graph.updateGraph(newGrid, dirty);
+    } else {
+        graph.buildGraph(newGrid);
+        stats.exploredStates = graph.size();
+    }
+    grid = newGrid;
+    stats.states = graph.size();
+
+    // The modules of each update get a context of their own. The JIT frees a module once it
+    // compiled it, and the context goes with the last of them, so types and constants uniqued
+    // for earlier versions do not pile up over a long session.
+    orc::ThreadSafeContext context(std::make_unique<LLVMContext>());
+    IRGenerator irgen(*context.getContext());
+    irgen.setGuardedStack(options.guardedStack);
+    irgen.setFuel(options.fuel);
+    std::vector<std::unique_ptr<Module>> regionModules;
+    std::string runName = "piet_run_" + std::to_string(++generation);
+    std::unique_ptr<Module> module(irgen.generateIncremental(
+        graph, kIncrementalRegionNodes, runName,
+        [&](const std::string &name) { return regionTrackers.count(name) > 0; }, regionModules));
+    stats.regions = (graph.size() + kIncrementalRegionNodes - 1) / kIncrementalRegionNodes;
+    stats.compiledRegions = regionModules.size();
+    // The regions this version calls: the functions its entry point declares.
+    std::set<std::string> usedRegions;
+    for (const Function &func : *module)
+        if (func.isDeclaration() && func.getName().startswith("piet_region_"))
+            usedRegions.insert(func.getName().str());
+
+    // Region code is kept for later versions; the entry point of this one replaces the last.
+    orc::JITDylib &dylib = jit->getMainJITDylib();
+    for (auto &regionModule : regionModules) {
+        std::string name = regionModule->getModuleIdentifier();
+        orc::ResourceTrackerSP regionTracker = dylib.createResourceTracker();
+        if (reportIfError(jit->addIRModule(regionTracker,
+                                           orc::ThreadSafeModule(std::move(regionModule), context))))
+            return false;
+        regionTrackers[name] = regionTracker;
+    }
+    orc::ResourceTrackerSP tracker = dylib.createResourceTracker();
+    if (reportIfError(jit->addIRModule(tracker, orc::ThreadSafeModule(std::move(module), context))))
+        return false;
+    Expected<JITEvaluatedSymbol> entrySymbol = jit->lookup(runName);
+    if (!entrySymbol) {
+        reportIfError(entrySymbol.takeError());
+        reportIfError(tracker->remove());
+        return false;
+    }
+    if (entryTracker)
+        reportIfError(entryTracker->remove());
+    entryTracker = tracker;
+    // Free the regions no version can call any more.
+    for (auto it = regionTrackers.begin(); it != regionTrackers.end();) {
+        if (usedRegions.count(it->first)) {
+            ++it;
+            continue;
+        }
+        reportIfError(it->second->remove());
+        it = regionTrackers.erase(it);
+    }
+    run = jitTargetAddressToFunction<piet_run_fn>(entrySymbol->getAddress());
+    return true;
+}
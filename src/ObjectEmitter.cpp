@@ -0,0 +1,56 @@
+#include "ObjectEmitter.h"
+#include "Diagnostics.h"
+#include "llvm/CodeGen/ParallelCG.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include <memory>
+#include <mutex>
+
+using namespace llvm;
+
+void initializeHostTarget() {
+    static std::once_flag initialized;
+    std::call_once(initialized, []() {
+        InitializeNativeTarget();
+        InitializeNativeTargetAsmPrinter();
+    });
+}
+
+// Helper: create a target machine for the host. Returns null (after reporting why) on failure.
+static std::unique_ptr<TargetMachine> createHostTargetMachine() {
+    initializeHostTarget();
+    std::string triple = sys::getDefaultTargetTriple();
+    std::string error;
+    const Target *target = TargetRegistry::lookupTarget(triple, error);
+    if (!target) {
+        reportError(error);
+        return nullptr;
+    }
+    return std::unique_ptr<TargetMachine>(
+        target->createTargetMachine(triple, "generic", "", TargetOptions(), Reloc::PIC_));
+}
+
+bool emitObjects(Module &module, const std::vector<raw_pwrite_stream*> &outputs) {
+    std::unique_ptr<TargetMachine> machine = createHostTargetMachine();
+    if (!machine)
+        return false;
+    module.setTargetTriple(machine->getTargetTriple().str());
+    module.setDataLayout(machine->createDataLayout());
+
+    if (outputs.size() > 1) {
+        splitCodeGen(module, outputs, {}, createHostTargetMachine, CGFT_ObjectFile);
+        return true;
+    }
+
+    legacy::PassManager passes;
+    if (machine->addPassesToEmitFile(passes, *outputs[0], nullptr, CGFT_ObjectFile)) {
+        reportError("the target cannot emit object files");
+        return false;
+    }
+    passes.run(module);
+    return true;
+}
@@ -1,15 +1,30 @@
 #include "Parser.h"
 #include "Utils.h"
 #include "ImageLoader.h"
+#include "PixelKernels.h"
+#include "Diagnostics.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include <fstream>
-#include <sstream>
-#include <iostream>
 #include <algorithm>
 #include <cctype>
+#include <cstring>
 
 Parser::Parser() {
 }
 
+static const char kCodelFileMagic[8] = { 'P', 'I', 'E', 'T', 'C', 'D', 'L', 0 };
+static const uint32_t kCodelFileVersion = 1;
+// The 5-bit code of the positions past the end of a short row.
+static const unsigned kCodelPadding = 31;
+static const unsigned kCodelBits = 5;
+// Codel files wider or taller than this are rejected before anything is allocated.
+static const uint32_t kMaxCodelDimension = 1u << 20;
+
+// Helper: the number of bytes of one packed row of width codels.
+static size_t codelRowBytes(uint32_t width) {
+    return (static_cast<size_t>(width) * kCodelBits + 7) / 8;
+}
+
 static std::string getExtension(const std::string &filename) {
     size_t pos = filename.find_last_of('.');
     if (pos == std::string::npos)
@@ -25,84 +40,262 @@ bool Parser::parseFile(const std::string &filename) {
         // --- IMAGE FILE HANDLING ---
         Image image;
         if (!loadImage(filename, image)) {
-            std::cerr << "Failed to load image: " << filename << "\n";
+            reportError("Failed to load image: " + filename);
             return false;
         }
-        // Determine the maximum candidate codel size N such that
-        // when dividing the image into non–overlapping N×N blocks, each block is uniform.
-        int maxCandidate = 1;
-        int maxN = std::min(image.width, image.height);
-        for (int n = 1; n <= maxN; ++n) {
-            if (image.width % n != 0 || image.height % n != 0)
-                continue; // Only consider divisors.
-            bool valid = true;
-            int numBlocksWidth = image.width / n;
-            int numBlocksHeight = image.height / n;
-            // For each block, check that all pixels match the top–left pixel.
-            for (int by = 0; by < numBlocksHeight && valid; ++by) {
-                for (int bx = 0; bx < numBlocksWidth && valid; ++bx) {
-                    int baseIndex = ((by * n) * image.width + (bx * n)) * 3;
-                    uint8_t r = image.data[baseIndex];
-                    uint8_t g = image.data[baseIndex + 1];
-                    uint8_t b = image.data[baseIndex + 2];
-                    for (int y = 0; y < n && valid; ++y) {
-                        for (int x = 0; x < n; ++x) {
-                            int index = (((by * n) + y) * image.width + (bx * n + x)) * 3;
-                            if (image.data[index] != r || image.data[index+1] != g || image.data[index+2] != b) {
-                                valid = false;
-                                break;
-                            }
-                        }
-                    }
+        parseImage(image);
+        return true;
+    }
+    // Text and codel files are mapped and parsed in place.
+    auto buffer = llvm::MemoryBuffer::getFile(filename, /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/false);
+    if (!buffer) {
+        reportError("Cannot open file " + filename);
+        return false;
+    }
+    const char *data = (*buffer)->getBufferStart();
+    size_t size = (*buffer)->getBufferSize();
+    if (size >= sizeof(kCodelFileMagic) && std::memcmp(data, kCodelFileMagic, sizeof(kCodelFileMagic)) == 0)
+        return parseCodels(data, size, filename);
+    parseText(data, size);
+    return true;
+}
+
+// Helper: returns true if data starts with the signature of an image format stb_image reads.
+static bool isImageData(const uint8_t *data, size_t size) {
+    static const char *signatures[] = { "\x89PNG", "BM", "GIF8" };
+    for (const char *signature : signatures) {
+        size_t length = std::strlen(signature);
+        if (size >= length && std::memcmp(data, signature, length) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool Parser::parseBuffer(const void *data, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t*>(data);
+    if (isImageData(bytes, size)) {
+        Image image;
+        if (!loadImageFromMemory(bytes, size, image)) {
+            reportError("Failed to load image from memory");
+            return false;
+        }
+        parseImage(image);
+        return true;
+    }
+    const char *chars = static_cast<const char*>(data);
+    if (size >= sizeof(kCodelFileMagic) && std::memcmp(chars, kCodelFileMagic, sizeof(kCodelFileMagic)) == 0)
+        return parseCodels(chars, size, "codel buffer");
+    parseText(chars, size);
+    return true;
+}
+
+void Parser::setGrid(std::vector<std::vector<PietColor>> codels) {
+    grid = std::move(codels);
+}
+
+void Parser::parseImage(const Image &image) {
+    // Determine the maximum candidate codel size N such that
+    // when dividing the image into non–overlapping N×N blocks, each block is uniform.
+    int maxCandidate = 1;
+    int maxN = std::min(image.width, image.height);
+    for (int n = 1; n <= maxN; ++n) {
+        if (image.width % n != 0 || image.height % n != 0)
+            continue; // Only consider divisors.
+        bool valid = true;
+        int numBlocksWidth = image.width / n;
+        int numBlocksHeight = image.height / n;
+        // For each block, check that all pixels match the top–left pixel,
+        // comparing one codel row (n pixels) at a time.
+        for (int by = 0; by < numBlocksHeight && valid; ++by) {
+            for (int bx = 0; bx < numBlocksWidth && valid; ++bx) {
+                const uint8_t *topLeft = &image.data[((by * n) * image.width + (bx * n)) * 3];
+                for (int y = 0; y < n && valid; ++y) {
+                    const uint8_t *row = topLeft + static_cast<size_t>(y) * image.width * 3;
+                    valid = pixelsMatch(row, n, topLeft);
                 }
             }
-            if (valid) {
-                maxCandidate = n; // update candidate if this block size works.
-            }
         }
-        int codelSize = maxCandidate;
-        std::cout << "Determined codel size: " << codelSize << "\n";
-
-        // Build the grid: each cell represents one codel.
-        int rows = image.height / codelSize;
-        int cols = image.width / codelSize;
-        grid.clear();
-        grid.resize(rows, std::vector<PietColor>(cols, PietColor::Undefined));
-        for (int r = 0; r < rows; ++r) {
-            for (int c = 0; c < cols; ++c) {
-                // Use the top–left pixel of the block as its color.
-                int index = ((r * codelSize) * image.width + (c * codelSize)) * 3;
-                uint8_t red   = image.data[index];
-                uint8_t green = image.data[index + 1];
-                uint8_t blue  = image.data[index + 2];
-                std::string hex = rgbToHex(red, green, blue);
-                grid[r][c] = hexToPietColor(hex);
-            }
+        if (valid) {
+            maxCandidate = n; // update candidate if this block size works.
         }
-        return true;
-    } else {
-        // --- TEXT FILE HANDLING (whitespace–separated hex codes) ---
-        std::ifstream infile(filename);
-        if (!infile) {
-            std::cerr << "Error: Cannot open file " << filename << "\n";
-            return false;
+    }
+    int codelSize = maxCandidate;
+    reportNote("Determined codel size: " + std::to_string(codelSize));
+
+    // Build the grid: each cell represents one codel.
+    int rows = image.height / codelSize;
+    int cols = image.width / codelSize;
+    grid.clear();
+    grid.resize(rows, std::vector<PietColor>(cols, PietColor::Undefined));
+    std::vector<uint8_t> samples(cols * 3), colors(cols);
+    for (int r = 0; r < rows; ++r) {
+        // Use the top–left pixel of each block as its color. With a codel size of 1 these
+        // are already contiguous; otherwise gather them first.
+        const uint8_t *rowData = &image.data[static_cast<size_t>(r * codelSize) * image.width * 3];
+        if (codelSize > 1) {
+            for (int c = 0; c < cols; ++c)
+                std::copy(rowData + c * codelSize * 3, rowData + c * codelSize * 3 + 3,
+                          &samples[c * 3]);
+            rowData = samples.data();
         }
-        grid.clear();
-        std::string line;
-        while (std::getline(infile, line)) {
-            if (line.empty())
+        classifyPixels(rowData, cols, colors.data());
+        for (int c = 0; c < cols; ++c)
+            grid[r][c] = static_cast<PietColor>(colors[c]);
+    }
+}
+
+// Helper: the value of a hex digit, or -1.
+static int hexDigit(unsigned char ch) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    ch |= 0x20; // lower case
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    return -1;
+}
+
+// Helper: whitespace that separates tokens within a line (as std::isspace, minus the newline).
+static bool isBlank(unsigned char ch) {
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\v' || ch == '\f';
+}
+
+void Parser::parseText(const char *data, size_t size) {
+    // --- TEXT HANDLING (whitespace–separated hex codes) ---
+    // Each token is decoded straight into an RGB triple; a row of triples is then classified
+    // in one pass.
+    const unsigned char *p = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char *end = p + size;
+
+    grid.clear();
+    std::vector<uint8_t> rgb, colors;
+    while (p < end) {
+        // One line. Empty lines are skipped; any other line is a row, even if it has no tokens.
+        if (*p == '\n') {
+            ++p;
+            continue;
+        }
+        rgb.clear();
+        while (p < end && *p != '\n') {
+            if (isBlank(*p)) {
+                ++p;
                 continue;
-            std::istringstream iss(line);
-            std::vector<PietColor> row;
-            std::string token;
-            while (iss >> token) {
-                row.push_back(hexToPietColor(token));
             }
-            grid.push_back(row);
+            const unsigned char *token = p;
+            while (p < end && *p != '\n' && !isBlank(*p))
+                ++p;
+            uint8_t channels[3] = { 1, 1, 1 }; // Not a Piet color: anything malformed is Undefined.
+            if (p - token == 6) {
+                int digits[6];
+                bool hex = true;
+                for (int i = 0; i < 6; ++i)
+                    hex &= (digits[i] = hexDigit(token[i])) >= 0;
+                if (hex) {
+                    for (int i = 0; i < 3; ++i)
+                        channels[i] = static_cast<uint8_t>(digits[2 * i] << 4 | digits[2 * i + 1]);
+                }
+            }
+            rgb.insert(rgb.end(), channels, channels + 3);
         }
-        infile.close();
-        return true;
+        size_t count = rgb.size() / 3;
+        colors.resize(count);
+        classifyPixels(rgb.data(), count, colors.data());
+        std::vector<PietColor> row(count);
+        for (size_t c = 0; c < count; ++c)
+            row[c] = static_cast<PietColor>(colors[c]);
+        grid.push_back(std::move(row));
+    }
+}
+
+void Parser::writeCodels(const std::vector<std::vector<PietColor>> &grid, std::string &out) {
+    CodelFileHeader header;
+    std::memcpy(header.magic, kCodelFileMagic, sizeof(header.magic));
+    header.version = kCodelFileVersion;
+    header.width = 0;
+    for (const auto &row : grid)
+        header.width = std::max<uint32_t>(header.width, row.size());
+    // A grid whose rows have no codels is written as the empty grid it behaves like.
+    header.height = header.width > 0 ? grid.size() : 0;
+    header.reserved = 0;
+
+    size_t rowBytes = codelRowBytes(header.width);
+    out.assign(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.resize(sizeof(header) + rowBytes * header.height, 0);
+    char *packed = &out[sizeof(header)];
+    for (const auto &row : grid) {
+        for (uint32_t c = 0; c < header.width; ++c) {
+            unsigned code = c < row.size() ? static_cast<unsigned>(row[c]) : kCodelPadding;
+            size_t bit = static_cast<size_t>(c) * kCodelBits;
+            unsigned shifted = code << (bit % 8);
+            packed[bit / 8] |= static_cast<char>(shifted & 0xFF);
+            if (shifted > 0xFF)
+                packed[bit / 8 + 1] |= static_cast<char>(shifted >> 8);
+        }
+        packed += rowBytes;
+    }
+}
+
+bool Parser::saveCodelFile(const std::string &filename,
+                           const std::vector<std::vector<PietColor>> &grid) {
+    std::string data;
+    writeCodels(grid, data);
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) {
+        reportError("Cannot open file " + filename);
+        return false;
+    }
+    out.write(data.data(), data.size());
+    return static_cast<bool>(out);
+}
+
+bool Parser::isCodelFile(const std::string &filename) {
+    std::ifstream in(filename, std::ios::binary);
+    char magic[sizeof(kCodelFileMagic)];
+    return in.read(magic, sizeof(magic)) && std::memcmp(magic, kCodelFileMagic, sizeof(magic)) == 0;
+}
+
+bool Parser::parseCodels(const char *data, size_t size, const std::string &name) {
+    CodelFileHeader header;
+    if (size < sizeof(header)) {
+        reportError(name + " is not a codel file");
+        return false;
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, kCodelFileMagic, sizeof(header.magic)) != 0 ||
+        header.version != kCodelFileVersion) {
+        reportError(name + " is not a version " + std::to_string(kCodelFileVersion) + " codel file");
+        return false;
+    }
+    // A grid of rows without codels cannot be written, and its size would not bound the height.
+    size_t rowBytes = codelRowBytes(header.width);
+    if (header.width > kMaxCodelDimension || header.height > kMaxCodelDimension ||
+        (header.width == 0 && header.height > 0) ||
+        size - sizeof(header) != rowBytes * header.height) {
+        reportError(name + " is truncated or corrupt");
+        return false;
+    }
+
+    grid.clear();
+    grid.reserve(header.height);
+    const unsigned char *packed = reinterpret_cast<const unsigned char*>(data) + sizeof(header);
+    for (uint32_t r = 0; r < header.height; ++r, packed += rowBytes) {
+        std::vector<PietColor> row;
+        row.reserve(header.width);
+        for (uint32_t c = 0; c < header.width; ++c) {
+            size_t bit = static_cast<size_t>(c) * kCodelBits;
+            unsigned window = packed[bit / 8];
+            if (bit % 8 > 8 - kCodelBits)
+                window |= static_cast<unsigned>(packed[bit / 8 + 1]) << 8;
+            unsigned code = (window >> (bit % 8)) & ((1u << kCodelBits) - 1);
+            if (code == kCodelPadding)
+                break;
+            if (code > static_cast<unsigned>(PietColor::Undefined)) {
+                reportError(name + " has an invalid codel in row " + std::to_string(r));
+                return false;
+            }
+            row.push_back(static_cast<PietColor>(code));
+        }
+        grid.push_back(std::move(row));
     }
+    return true;
 }
 
 const std::vector<std::vector<PietColor>>& Parser::getGrid() const {
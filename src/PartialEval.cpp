@@ -0,0 +1,148 @@
+#include "PartialEval.h"
+#include "StackVM.h"
+#include <climits>
+#include <csignal>
+#include <cstdio>
+
+// The prefix's stack and output become constants of the generated program, so they are kept
+// to a size that is cheap to embed.
+static const int kMaxPrefixStack = 16 * 1024;
+static const size_t kMaxPrefixOutput = 64 * 1024;
+
+// Helper: the value n places below the top of the stack, as a pop would return it.
+static int peek(const Stack *stack, int n) {
+    return stack->size > n ? stack->data[stack->size - 1 - n] : 0;
+}
+
+// Helper: returns true if the node's command can be evaluated at compile time.
+static bool canEvaluate(Command command, const Stack *stack) {
+    switch (command) {
+        case Command::InputNum:
+        case Command::InputChar:
+            return false;
+        case Command::Divide:
+        case Command::Modulo: {
+            int divisor = peek(stack, 0);
+            return divisor != 0 && !(divisor == -1 && peek(stack, 1) == INT_MIN);
+        }
+        default:
+            return true;
+    }
+}
+
+bool executeStackCommand(Stack *stack, Command command, int blockSize) {
+    // Arithmetic wraps around like the generated i32 operations.
+    switch (command) {
+        case Command::Push:
+            stackPush(stack, blockSize);
+            break;
+        case Command::Pop:
+            stackPop(stack);
+            break;
+        case Command::Add: {
+            unsigned a = stackPop(stack), b = stackPop(stack);
+            stackPush(stack, static_cast<int>(b + a));
+            break;
+        }
+        case Command::Subtract: {
+            unsigned a = stackPop(stack), b = stackPop(stack);
+            stackPush(stack, static_cast<int>(b - a));
+            break;
+        }
+        case Command::Multiply: {
+            unsigned a = stackPop(stack), b = stackPop(stack);
+            stackPush(stack, static_cast<int>(b * a));
+            break;
+        }
+        case Command::Divide:
+        case Command::Modulo: {
+            int a = stackPop(stack), b = stackPop(stack);
+            if (a == 0 || (a == -1 && b == INT_MIN))
+                std::raise(SIGFPE);
+            stackPush(stack, command == Command::Divide ? b / a : b % a);
+            break;
+        }
+        case Command::Not:
+            stackPush(stack, stackPop(stack) == 0 ? 1 : 0);
+            break;
+        case Command::Greater: {
+            int a = stackPop(stack), b = stackPop(stack);
+            stackPush(stack, b > a ? 1 : 0);
+            break;
+        }
+        case Command::Duplicate: {
+            int top = stackPop(stack);
+            stackPush(stack, top);
+            stackPush(stack, top);
+            break;
+        }
+        case Command::Roll: {
+            int rolls = stackPop(stack);
+            int depth = stackPop(stack);
+            stackRoll(stack, rolls, depth);
+            break;
+        }
+        case Command::InputNum:
+        case Command::InputChar:
+        case Command::OutputNum:
+        case Command::OutputChar:
+            return false;
+        default:
+            break;
+    }
+    return true;
+}
+
+ProgramPrefix evaluatePrefix(const Graph &graph, uint64_t maxSteps) {
+    ProgramPrefix prefix;
+    if (graph.empty())
+        return prefix;
+
+    // The runtime's own stack operations, so that pops of an empty stack and rolls behave
+    // exactly as at run time.
+    Stack *stack = createStack();
+    int node = 0;
+    uint64_t steps = 0;
+    while (steps < maxSteps && stack->size <= kMaxPrefixStack &&
+           prefix.output.size() <= kMaxPrefixOutput) {
+        EdgeRange transitions = graph.getTransitions(node);
+        if (transitions.empty()) {
+            prefix.terminated = true;
+            break;
+        }
+        if (transitions.size() > 1) {
+            // Choose the transition with the popped value, as the generated switch does.
+            unsigned choice = static_cast<unsigned>(stackPop(stack));
+            node = transitions[choice % transitions.size()].targetNode;
+            ++steps;
+            continue;
+        }
+
+        Command command = transitions[0].command;
+        if (!canEvaluate(command, stack))
+            break;
+        switch (command) {
+            case Command::OutputNum: {
+                char digits[16];
+                int length = std::snprintf(digits, sizeof(digits), "%d", stackPop(stack));
+                prefix.output.append(digits, length);
+                break;
+            }
+            case Command::OutputChar:
+                prefix.output.push_back(static_cast<char>(stackPop(stack)));
+                break;
+            default:
+                executeStackCommand(stack, command, graph.getNode(node).blockSize);
+                break;
+        }
+        node = transitions[0].targetNode;
+        ++steps;
+    }
+
+    prefix.node = node;
+    prefix.steps = steps;
+    if (!prefix.terminated)
+        prefix.stack.assign(stack->data, stack->data + stack->size);
+    destroyStack(stack);
+    return prefix;
+}
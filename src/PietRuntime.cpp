@@ -0,0 +1,158 @@
+#include "PietRuntime.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// Create a context that reads from a buffer and collects output in memory.
+piet_ctx* pietCreateContext(const char *input, size_t inputSize) {
+    piet_ctx *ctx = new piet_ctx();
+    ctx->input = input;
+    ctx->inputSize = input ? inputSize : 0;
+    return ctx;
+}
+
+// Create a context bound to stdin and stdout.
+piet_ctx* pietCreateStdioContext() {
+    return pietCreateStreamContext(stdin, stdout);
+}
+
+// Create a context bound to two streams.
+piet_ctx* pietCreateStreamContext(FILE *in, FILE *out) {
+    piet_ctx *ctx = new piet_ctx();
+    ctx->stdio = 1;
+    ctx->in = in;
+    ctx->out = out;
+    return ctx;
+}
+
+// Destroy a context.
+void pietDestroyContext(piet_ctx *ctx) {
+    if (!ctx) return;
+    destroyStack(ctx->stack);
+    std::free(ctx->output);
+    delete ctx;
+}
+
+// Rewind the input and discard the output.
+void pietResetContext(piet_ctx *ctx) {
+    ctx->inputPos = 0;
+    ctx->outputSize = 0;
+}
+
+// Return the emptied stack of the context, with room for capacity values.
+Stack* pietPrepareStack(piet_ctx *ctx, int capacity) {
+    Stack *stack = ctx->stack;
+    if (!stack) {
+        stack = ctx->stack = capacity > 0 ? createStackWithCapacity(capacity) : createStack();
+    } else if (stack->capacity < capacity) {
+        int *data = static_cast<int*>(std::realloc(stack->data, sizeof(int) * capacity));
+        if (!data)
+            std::abort();
+        stack->data = data;
+        stack->capacity = capacity;
+    }
+    stack->size = 0;
+    return stack;
+}
+
+// Return the emptied guarded stack of the context.
+Stack* pietPrepareGuardedStack(piet_ctx *ctx) {
+    if (ctx->stack && !ctx->stack->guarded) {
+        destroyStack(ctx->stack);
+        ctx->stack = nullptr;
+    }
+    if (!ctx->stack) {
+        ctx->stack = createGuardedStack();
+        if (!ctx->stack) {
+            std::fprintf(stderr, "Error: cannot reserve a guarded stack\n");
+            std::abort();
+        }
+    }
+    ctx->stack->size = 0;
+    return ctx->stack;
+}
+
+// Helper: append bytes to the output buffer of a context.
+static void appendOutput(piet_ctx *ctx, const char *bytes, size_t count) {
+    if (ctx->outputSize + count > ctx->outputCapacity) {
+        size_t capacity = std::max<size_t>(ctx->outputCapacity * 2, ctx->outputSize + count);
+        capacity = std::max<size_t>(capacity, 256);
+        char *output = static_cast<char*>(std::realloc(ctx->output, capacity));
+        if (!output)
+            std::abort();
+        ctx->output = output;
+        ctx->outputCapacity = capacity;
+    }
+    std::memcpy(ctx->output + ctx->outputSize, bytes, count);
+    ctx->outputSize += count;
+}
+
+// Write a block of output.
+void pietWriteOutput(piet_ctx *ctx, const char *bytes, int length) {
+    if (ctx->stdio) {
+        std::fwrite(bytes, 1, length, ctx->out);
+        return;
+    }
+    appendOutput(ctx, bytes, length);
+}
+
+// Read one byte and push it, unless the input is exhausted.
+void pietInputChar(piet_ctx *ctx) {
+    if (ctx->stdio) {
+        int ch = std::getc(ctx->in);
+        if (ch != EOF)
+            stackPush(ctx->stack, ch);
+        return;
+    }
+    if (ctx->inputPos < ctx->inputSize)
+        stackPush(ctx->stack, static_cast<unsigned char>(ctx->input[ctx->inputPos++]));
+}
+
+// Read a decimal integer and push it, if there is one.
+void pietInputNum(piet_ctx *ctx) {
+    if (ctx->stdio) {
+        int value;
+        if (std::fscanf(ctx->in, "%d", &value) == 1)
+            stackPush(ctx->stack, value);
+        return;
+    }
+    size_t pos = ctx->inputPos;
+    while (pos < ctx->inputSize && std::isspace(static_cast<unsigned char>(ctx->input[pos])))
+        ++pos;
+    ctx->inputPos = pos;
+    bool negative = false;
+    if (pos < ctx->inputSize && (ctx->input[pos] == '-' || ctx->input[pos] == '+'))
+        negative = ctx->input[pos++] == '-';
+    if (pos >= ctx->inputSize || !std::isdigit(static_cast<unsigned char>(ctx->input[pos])))
+        return; // Not a number: leave the input at the first non-blank character.
+    // Accumulate in unsigned arithmetic; out-of-range numbers wrap like the stack's int math.
+    unsigned value = 0;
+    while (pos < ctx->inputSize && std::isdigit(static_cast<unsigned char>(ctx->input[pos])))
+        value = value * 10 + (ctx->input[pos++] - '0');
+    ctx->inputPos = pos;
+    stackPush(ctx->stack, static_cast<int>(negative ? 0u - value : value));
+}
+
+// Write the low byte of value.
+void pietOutputChar(piet_ctx *ctx, int value) {
+    if (ctx->stdio) {
+        std::putc(value, ctx->out);
+        return;
+    }
+    char ch = static_cast<char>(value);
+    appendOutput(ctx, &ch, 1);
+}
+
+// Write value in decimal.
+void pietOutputNum(piet_ctx *ctx, int value) {
+    char digits[16];
+    int length = std::snprintf(digits, sizeof(digits), "%d", value);
+    if (ctx->stdio) {
+        std::fwrite(digits, 1, length, ctx->out);
+        return;
+    }
+    appendOutput(ctx, digits, length);
+}
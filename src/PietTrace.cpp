@@ -0,0 +1,124 @@
+#include "PietTrace.h"
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Records per thread buffer: 768 KiB, flushed in one write when full.
+static const uint32_t kTraceBufferRecords = 64 * 1024;
+
+// A chunk in the making; header and records are contiguous so a flush is a single write.
+struct TraceBuffer {
+    TraceChunkHeader header;
+    TraceRecord records[kTraceBufferRecords];
+};
+
+static int traceFd = -1;
+static std::once_flag traceOnce;
+static std::atomic<uint32_t> nextThread{0};
+
+// Helper: append the buffered records to the trace file (async-signal-safe).
+static void flushBuffer(TraceBuffer *buffer) {
+    if (!buffer || buffer->header.count == 0)
+        return;
+    if (traceFd >= 0) {
+        const char *data = reinterpret_cast<const char*>(buffer);
+        size_t remaining = sizeof(TraceChunkHeader) + sizeof(TraceRecord) * buffer->header.count;
+        while (remaining > 0) {
+            ssize_t written = write(traceFd, data, remaining);
+            if (written <= 0)
+                break;
+            data += written;
+            remaining -= written;
+        }
+    }
+    buffer->header.count = 0;
+}
+
+// Owns the buffer of one thread and flushes it when the thread (or, for the main thread,
+// the program) exits.
+struct ThreadTrace {
+    TraceBuffer *buffer = nullptr;
+    ~ThreadTrace() {
+        flushBuffer(buffer);
+        std::free(buffer);
+    }
+};
+static thread_local ThreadTrace threadTrace;
+
+// The signals whose default action ends the program, and the actions installed before ours.
+static const int kFatalSignals[] = { SIGFPE, SIGSEGV, SIGBUS, SIGILL, SIGABRT, SIGINT, SIGTERM };
+static struct sigaction previousActions[sizeof(kFatalSignals) / sizeof(kFatalSignals[0])];
+
+// Flush the interrupted thread's records before a fatal signal takes the program down.
+// A handler installed before ours (such as the guarded stack's, which resolves some SIGSEGVs)
+// runs next; otherwise the signal is raised again with its default action.
+static void flushOnSignal(int sig, siginfo_t *info, void *ucontext) {
+    flushBuffer(threadTrace.buffer);
+    for (size_t i = 0; i < sizeof(kFatalSignals) / sizeof(kFatalSignals[0]); ++i) {
+        if (kFatalSignals[i] != sig)
+            continue;
+        const struct sigaction &previous = previousActions[i];
+        if (previous.sa_flags & SA_SIGINFO) {
+            previous.sa_sigaction(sig, info, ucontext);
+            return;
+        }
+        if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN) {
+            previous.sa_handler(sig);
+            return;
+        }
+    }
+    std::signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+void pietTraceStart(int numNodes) {
+    std::call_once(traceOnce, [numNodes]() {
+        const char *path = std::getenv("PIETRIC_TRACE_FILE");
+        if (!path || !*path)
+            path = "piet.trace";
+        traceFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if (traceFd < 0) {
+            std::fprintf(stderr, "Error: cannot open trace file %s\n", path);
+            return;
+        }
+        TraceFileHeader header;
+        std::memcpy(header.magic, kTraceFileMagic, sizeof(header.magic));
+        header.version = kTraceFileVersion;
+        header.numNodes = numNodes;
+        if (write(traceFd, &header, sizeof(header)) != static_cast<ssize_t>(sizeof(header))) {
+            close(traceFd);
+            traceFd = -1;
+            return;
+        }
+        struct sigaction action;
+        std::memset(&action, 0, sizeof(action));
+        action.sa_sigaction = flushOnSignal;
+        action.sa_flags = SA_SIGINFO | SA_NODEFER;
+        sigemptyset(&action.sa_mask);
+        for (size_t i = 0; i < sizeof(kFatalSignals) / sizeof(kFatalSignals[0]); ++i)
+            sigaction(kFatalSignals[i], &action, &previousActions[i]);
+    });
+}
+
+void pietTrace(Stack* stack, int node, int command) {
+    TraceBuffer *buffer = threadTrace.buffer;
+    if (__builtin_expect(!buffer, 0)) {
+        buffer = static_cast<TraceBuffer*>(std::calloc(1, sizeof(TraceBuffer)));
+        if (!buffer)
+            return;
+        buffer->header.thread = nextThread++;
+        buffer->header.count = 0;
+        threadTrace.buffer = buffer;
+    }
+    if (__builtin_expect(buffer->header.count == kTraceBufferRecords, 0))
+        flushBuffer(buffer);
+    TraceRecord &record = buffer->records[buffer->header.count++];
+    record.node = node;
+    record.top = stack->size > 0 ? stack->data[stack->size - 1] : 0;
+    record.command = command;
+}
@@ -0,0 +1,265 @@
+#include "PixelKernels.h"
+#include "PietTypes.h"
+#include <cstdlib>
+#include <string>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PIETRIC_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+// --- Lookup tables ---
+// Each channel is reduced to a 2-bit code (0x00 -> 0, 0xC0 -> 1, 0xFF -> 2, anything else -> 3),
+// and the three codes of a pixel index a 64-entry color table as (r << 4) | (g << 2) | b.
+// The SIMD kernels use the same table, 16 entries (one red code) at a time.
+struct ColorTables {
+    uint8_t channelCode[256];
+    alignas(16) uint8_t color[64];
+};
+
+static constexpr ColorTables makeColorTables() {
+    struct Entry { int r, g, b; PietColor color; };
+    const Entry entries[] = {
+        {2, 1, 1, PietColor::LightRed},  {2, 2, 1, PietColor::LightYellow},
+        {1, 2, 1, PietColor::LightGreen}, {1, 2, 2, PietColor::LightCyan},
+        {1, 1, 2, PietColor::LightBlue}, {2, 1, 2, PietColor::LightMagenta},
+        {2, 0, 0, PietColor::Red},       {2, 2, 0, PietColor::Yellow},
+        {0, 2, 0, PietColor::Green},     {0, 2, 2, PietColor::Cyan},
+        {0, 0, 2, PietColor::Blue},      {2, 0, 2, PietColor::Magenta},
+        {1, 0, 0, PietColor::DarkRed},   {1, 1, 0, PietColor::DarkYellow},
+        {0, 1, 0, PietColor::DarkGreen}, {0, 1, 1, PietColor::DarkCyan},
+        {0, 0, 1, PietColor::DarkBlue},  {1, 0, 1, PietColor::DarkMagenta},
+        {2, 2, 2, PietColor::White},     {0, 0, 0, PietColor::Black},
+    };
+    ColorTables tables{};
+    for (int i = 0; i < 256; ++i)
+        tables.channelCode[i] = i == 0x00 ? 0 : i == 0xC0 ? 1 : i == 0xFF ? 2 : 3;
+    for (int i = 0; i < 64; ++i)
+        tables.color[i] = static_cast<uint8_t>(PietColor::Undefined);
+    for (const Entry &e : entries)
+        tables.color[(e.r << 4) | (e.g << 2) | e.b] = static_cast<uint8_t>(e.color);
+    return tables;
+}
+
+static constexpr ColorTables kTables = makeColorTables();
+
+// --- Scalar kernels ---
+static void classifyScalar(const uint8_t *rgb, size_t count, uint8_t *out) {
+    for (size_t i = 0; i < count; ++i, rgb += 3) {
+        int index = (kTables.channelCode[rgb[0]] << 4) | (kTables.channelCode[rgb[1]] << 2) |
+                    kTables.channelCode[rgb[2]];
+        out[i] = kTables.color[index];
+    }
+}
+
+static bool matchScalar(const uint8_t *rgb, size_t count, const uint8_t *reference) {
+    for (size_t i = 0; i < count; ++i, rgb += 3) {
+        if (rgb[0] != reference[0] || rgb[1] != reference[1] || rgb[2] != reference[2])
+            return false;
+    }
+    return true;
+}
+
+#ifdef PIETRIC_X86_KERNELS
+// pshufb masks that gather one channel of 16 pixels (48 bytes in three registers):
+// kDeinterleave.mask[channel][register] picks that register's share of the channel bytes.
+struct DeinterleaveMasks {
+    alignas(16) int8_t mask[3][3][16];
+};
+
+static constexpr DeinterleaveMasks makeDeinterleaveMasks() {
+    DeinterleaveMasks masks{};
+    for (int channel = 0; channel < 3; ++channel)
+        for (int reg = 0; reg < 3; ++reg)
+            for (int i = 0; i < 16; ++i) {
+                int source = 3 * i + channel;
+                masks.mask[channel][reg][i] = source / 16 == reg ? source % 16 : -128;
+            }
+    return masks;
+}
+
+static constexpr DeinterleaveMasks kDeinterleave = makeDeinterleaveMasks();
+
+// --- SSE4.1 kernels (16 pixels per step) ---
+__attribute__((target("sse4.1")))
+static inline __m128i channelCodesSSE(__m128i x) {
+    __m128i isC0 = _mm_cmpeq_epi8(x, _mm_set1_epi8(static_cast<char>(0xC0)));
+    __m128i isFF = _mm_cmpeq_epi8(x, _mm_set1_epi8(static_cast<char>(0xFF)));
+    __m128i is00 = _mm_cmpeq_epi8(x, _mm_setzero_si128());
+    __m128i valid = _mm_or_si128(_mm_or_si128(isC0, isFF), is00);
+    __m128i code = _mm_or_si128(_mm_and_si128(isC0, _mm_set1_epi8(1)),
+                                _mm_and_si128(isFF, _mm_set1_epi8(2)));
+    return _mm_or_si128(code, _mm_andnot_si128(valid, _mm_set1_epi8(3)));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i gatherChannelSSE(__m128i a, __m128i b, __m128i c, int channel) {
+    const auto &m = kDeinterleave.mask[channel];
+    return _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(a, _mm_load_si128(reinterpret_cast<const __m128i*>(m[0]))),
+                     _mm_shuffle_epi8(b, _mm_load_si128(reinterpret_cast<const __m128i*>(m[1])))),
+        _mm_shuffle_epi8(c, _mm_load_si128(reinterpret_cast<const __m128i*>(m[2]))));
+}
+
+__attribute__((target("sse4.1")))
+static void classifySSE41(const uint8_t *rgb, size_t count, uint8_t *out) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i *src = reinterpret_cast<const __m128i*>(rgb + 3 * i);
+        __m128i a = _mm_loadu_si128(src), b = _mm_loadu_si128(src + 1), c = _mm_loadu_si128(src + 2);
+        __m128i r = channelCodesSSE(gatherChannelSSE(a, b, c, 0));
+        __m128i g = channelCodesSSE(gatherChannelSSE(a, b, c, 1));
+        __m128i bl = channelCodesSSE(gatherChannelSSE(a, b, c, 2));
+        __m128i g4 = _mm_add_epi8(g, g);
+        __m128i gb = _mm_or_si128(_mm_add_epi8(g4, g4), bl);
+        __m128i result = _mm_set1_epi8(static_cast<char>(PietColor::Undefined));
+        for (int red = 0; red < 3; ++red) {
+            __m128i lut = _mm_load_si128(reinterpret_cast<const __m128i*>(kTables.color + 16 * red));
+            result = _mm_blendv_epi8(result, _mm_shuffle_epi8(lut, gb),
+                                     _mm_cmpeq_epi8(r, _mm_set1_epi8(red)));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), result);
+    }
+    classifyScalar(rgb + 3 * i, count - i, out + i);
+}
+
+__attribute__((target("sse4.1")))
+static bool matchSSE41(const uint8_t *rgb, size_t count, const uint8_t *reference) {
+    // The reference pixel repeated over 48 bytes, i.e. 16 pixels.
+    alignas(16) uint8_t pattern[48];
+    for (int i = 0; i < 48; ++i)
+        pattern[i] = reference[i % 3];
+    const __m128i *p = reinterpret_cast<const __m128i*>(pattern);
+    __m128i p0 = _mm_load_si128(p), p1 = _mm_load_si128(p + 1), p2 = _mm_load_si128(p + 2);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i *src = reinterpret_cast<const __m128i*>(rgb + 3 * i);
+        __m128i eq = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(src), p0),
+                                                 _mm_cmpeq_epi8(_mm_loadu_si128(src + 1), p1)),
+                                   _mm_cmpeq_epi8(_mm_loadu_si128(src + 2), p2));
+        if (_mm_movemask_epi8(eq) != 0xFFFF)
+            return false;
+    }
+    return matchScalar(rgb + 3 * i, count - i, reference);
+}
+
+// --- AVX2 kernels (32 pixels per step) ---
+// vpshufb works within 128-bit lanes, so the low lane handles pixels 0-15 and the high lane
+// pixels 16-31, each exactly like the SSE kernel.
+__attribute__((target("avx2")))
+static inline __m256i loadLanes(const uint8_t *low, const uint8_t *high) {
+    return _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(low))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(high)), 1);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i broadcastLane(const void *data) {
+    return _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(data)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i channelCodesAVX2(__m256i x) {
+    __m256i isC0 = _mm256_cmpeq_epi8(x, _mm256_set1_epi8(static_cast<char>(0xC0)));
+    __m256i isFF = _mm256_cmpeq_epi8(x, _mm256_set1_epi8(static_cast<char>(0xFF)));
+    __m256i is00 = _mm256_cmpeq_epi8(x, _mm256_setzero_si256());
+    __m256i valid = _mm256_or_si256(_mm256_or_si256(isC0, isFF), is00);
+    __m256i code = _mm256_or_si256(_mm256_and_si256(isC0, _mm256_set1_epi8(1)),
+                                   _mm256_and_si256(isFF, _mm256_set1_epi8(2)));
+    return _mm256_or_si256(code, _mm256_andnot_si256(valid, _mm256_set1_epi8(3)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i gatherChannelAVX2(__m256i a, __m256i b, __m256i c, int channel) {
+    const auto &m = kDeinterleave.mask[channel];
+    return _mm256_or_si256(
+        _mm256_or_si256(_mm256_shuffle_epi8(a, broadcastLane(m[0])),
+                        _mm256_shuffle_epi8(b, broadcastLane(m[1]))),
+        _mm256_shuffle_epi8(c, broadcastLane(m[2])));
+}
+
+__attribute__((target("avx2")))
+static void classifyAVX2(const uint8_t *rgb, size_t count, uint8_t *out) {
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        const uint8_t *src = rgb + 3 * i;
+        __m256i a = loadLanes(src, src + 48);
+        __m256i b = loadLanes(src + 16, src + 64);
+        __m256i c = loadLanes(src + 32, src + 80);
+        __m256i r = channelCodesAVX2(gatherChannelAVX2(a, b, c, 0));
+        __m256i g = channelCodesAVX2(gatherChannelAVX2(a, b, c, 1));
+        __m256i bl = channelCodesAVX2(gatherChannelAVX2(a, b, c, 2));
+        __m256i g4 = _mm256_add_epi8(g, g);
+        __m256i gb = _mm256_or_si256(_mm256_add_epi8(g4, g4), bl);
+        __m256i result = _mm256_set1_epi8(static_cast<char>(PietColor::Undefined));
+        for (int red = 0; red < 3; ++red) {
+            __m256i lut = broadcastLane(kTables.color + 16 * red);
+            result = _mm256_blendv_epi8(result, _mm256_shuffle_epi8(lut, gb),
+                                        _mm256_cmpeq_epi8(r, _mm256_set1_epi8(red)));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), result);
+    }
+    classifySSE41(rgb + 3 * i, count - i, out + i);
+}
+
+__attribute__((target("avx2")))
+static bool matchAVX2(const uint8_t *rgb, size_t count, const uint8_t *reference) {
+    // The reference pixel repeated over 96 bytes, i.e. 32 pixels.
+    alignas(32) uint8_t pattern[96];
+    for (int i = 0; i < 96; ++i)
+        pattern[i] = reference[i % 3];
+    const __m256i *p = reinterpret_cast<const __m256i*>(pattern);
+    __m256i p0 = _mm256_load_si256(p), p1 = _mm256_load_si256(p + 1), p2 = _mm256_load_si256(p + 2);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        const __m256i *src = reinterpret_cast<const __m256i*>(rgb + 3 * i);
+        __m256i eq = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256(src), p0),
+                             _mm256_cmpeq_epi8(_mm256_loadu_si256(src + 1), p1)),
+            _mm256_cmpeq_epi8(_mm256_loadu_si256(src + 2), p2));
+        if (_mm256_movemask_epi8(eq) != -1)
+            return false;
+    }
+    return matchSSE41(rgb + 3 * i, count - i, reference);
+}
+#endif // PIETRIC_X86_KERNELS
+
+// --- Dispatch ---
+struct PixelKernels {
+    const char *name;
+    void (*classify)(const uint8_t*, size_t, uint8_t*);
+    bool (*match)(const uint8_t*, size_t, const uint8_t*);
+};
+
+static PixelKernels selectKernels() {
+    const char *env = std::getenv("PIETRIC_SIMD");
+    std::string limit = env ? env : "";
+#ifdef PIETRIC_X86_KERNELS
+    if (limit.empty() || limit == "avx2") {
+        if (__builtin_cpu_supports("avx2"))
+            return { "avx2", classifyAVX2, matchAVX2 };
+    }
+    if (limit.empty() || limit == "avx2" || limit == "sse4.1") {
+        if (__builtin_cpu_supports("sse4.1"))
+            return { "sse4.1", classifySSE41, matchSSE41 };
+    }
+#endif
+    return { "scalar", classifyScalar, matchScalar };
+}
+
+static const PixelKernels &kernels() {
+    static const PixelKernels selected = selectKernels();
+    return selected;
+}
+
+void classifyPixels(const uint8_t *rgb, size_t count, uint8_t *out) {
+    kernels().classify(rgb, count, out);
+}
+
+bool pixelsMatch(const uint8_t *rgb, size_t count, const uint8_t *reference) {
+    return kernels().match(rgb, count, reference);
+}
+
+const char *pixelKernelName() {
+    return kernels().name;
+}
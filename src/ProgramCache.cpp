@@ -0,0 +1,95 @@
+#include "ProgramCache.h"
+#include "CompileCache.h"
+#include "Diagnostics.h"
+#include "Parser.h"
+#include <filesystem>
+#include <sys/stat.h>
+
+ProgramCache::ProgramCache(size_t maxEntries) : maxEntries(maxEntries > 0 ? maxEntries : 1) {}
+
+template <typename Value>
+std::shared_ptr<const Value> ProgramCache::find(Table<Value> &table, const std::string &key,
+                                                const std::string &version) {
+    auto it = table.index.find(key);
+    if (it == table.index.end() || it->second->version != version)
+        return nullptr;
+    table.entries.splice(table.entries.begin(), table.entries, it->second);
+    return it->second->value;
+}
+
+template <typename Value>
+void ProgramCache::insert(Table<Value> &table, const std::string &key, const std::string &version,
+                          std::shared_ptr<const Value> value) {
+    auto it = table.index.find(key);
+    if (it != table.index.end()) {
+        table.entries.erase(it->second);
+        table.index.erase(it);
+    }
+    table.entries.push_front({key, version, std::move(value)});
+    table.index[key] = table.entries.begin();
+    if (table.entries.size() > maxEntries) {
+        table.index.erase(table.entries.back().key);
+        table.entries.pop_back();
+    }
+}
+
+std::shared_ptr<const std::vector<std::vector<PietColor>>> ProgramCache::grid(const std::string &path) {
+    // Files are identified by absolute path; a file replaced or rewritten since it was parsed
+    // (a new inode, size or modification time) is parsed again.
+    std::error_code ec;
+    std::string key = std::filesystem::absolute(path, ec).lexically_normal().string();
+    if (ec)
+        key = path;
+    std::string version;
+    struct stat info;
+    if (stat(path.c_str(), &info) == 0) {
+        version = std::to_string(info.st_dev) + ":" + std::to_string(info.st_ino) + ":" +
+                  std::to_string(info.st_size) + ":" + std::to_string(info.st_mtim.tv_sec) + "." +
+                  std::to_string(info.st_mtim.tv_nsec);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (auto cached = find(grids, key, version)) {
+            ++counters.gridHits;
+            return cached;
+        }
+        ++counters.gridMisses;
+    }
+
+    // Parse without holding the lock; two threads missing on one file both parse it.
+    Parser parser;
+    if (!parser.parseFile(path)) {
+        reportError("Failed to parse the input file.");
+        return nullptr;
+    }
+    auto parsed = std::make_shared<const std::vector<std::vector<PietColor>>>(parser.getGrid());
+    if (!version.empty()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        insert(grids, key, version, parsed);
+    }
+    return parsed;
+}
+
+std::shared_ptr<const Graph> ProgramCache::graph(const std::vector<std::vector<PietColor>> &grid,
+                                                 bool minimize) {
+    std::string key = CompileCache::computeKey(grid, minimize ? "graph;minimize=1" : "graph;minimize=0");
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (auto cached = find(graphs, key, std::string())) {
+            ++counters.graphHits;
+            return cached;
+        }
+        ++counters.graphMisses;
+    }
+
+    auto built = std::make_shared<Graph>();
+    built->buildGraph(grid);
+    if (minimize)
+        built->minimize();
+    std::lock_guard<std::mutex> lock(mutex);
+    insert(graphs, key, std::string(), std::shared_ptr<const Graph>(built));
+    return built;
+}
+
+ProgramCache::Stats ProgramCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+}
@@ -0,0 +1,104 @@
+#include "StackBounds.h"
+#include <algorithm>
+#include <deque>
+
+// A node whose interval has been widened this many times jumps to the widest bounds it can
+// have, so that loops that grow (or shrink) the stack reach a fixed point quickly.
+static const int kWidenAfter = 3;
+
+void stackEffect(Command command, int &pops, int &minPushes, int &maxPushes) {
+    pops = minPushes = maxPushes = 0;
+    switch (command) {
+        case Command::Push:       minPushes = maxPushes = 1; break;
+        case Command::Pop:        pops = 1; break;
+        case Command::Add:
+        case Command::Subtract:
+        case Command::Multiply:
+        case Command::Divide:
+        case Command::Modulo:
+        case Command::Greater:    pops = 2; minPushes = maxPushes = 1; break;
+        case Command::Not:        pops = 1; minPushes = maxPushes = 1; break;
+        case Command::Duplicate:  pops = 1; minPushes = maxPushes = 2; break;
+        case Command::Roll:       pops = 2; break;
+        case Command::InputNum:
+        case Command::InputChar:  maxPushes = 1; break; // Nothing is pushed at the end of input.
+        case Command::OutputNum:
+        case Command::OutputChar: pops = 1; break;
+        default:                  break;
+    }
+}
+
+// Helper: the depth after popping pops values and pushing pushes values at depth d.
+static int applyEffect(int d, int pops, int pushes) {
+    if (d == kUnboundedDepth)
+        return d;
+    return std::max(d - pops, 0) + pushes;
+}
+
+// Helper: the depth interval on leaving a node entered with the given interval.
+static DepthInterval nodeExit(EdgeRange transitions, DepthInterval in) {
+    int pops = 1, minPushes = 0, maxPushes = 0; // A multi-transition node pops its choice.
+    if (transitions.size() == 1)
+        stackEffect(transitions[0].command, pops, minPushes, maxPushes);
+    DepthInterval out;
+    out.lo = applyEffect(in.lo, pops, minPushes);
+    out.hi = applyEffect(in.hi, pops, maxPushes);
+    return out;
+}
+
+std::vector<DepthInterval> computeStackBounds(const Graph &graph, int initialDepth) {
+    std::vector<DepthInterval> bounds(graph.size());
+    if (graph.empty())
+        return bounds;
+    std::vector<int> updates(graph.size(), 0);
+    std::vector<bool> queued(graph.size(), false);
+    std::deque<int> worklist;
+    bounds[0].lo = bounds[0].hi = initialDepth;
+    worklist.push_back(0);
+    queued[0] = true;
+
+    while (!worklist.empty()) {
+        int id = worklist.front();
+        worklist.pop_front();
+        queued[id] = false;
+        EdgeRange transitions = graph.getTransitions(id);
+        if (transitions.empty())
+            continue;
+        DepthInterval out = nodeExit(transitions, bounds[id]);
+        for (const auto &edge : transitions) {
+            int target = edge.targetNode;
+            DepthInterval &b = bounds[target];
+            DepthInterval joined = out;
+            if (b.reachable()) {
+                joined.lo = std::min(b.lo, out.lo);
+                joined.hi = std::max(b.hi, out.hi);
+                if (joined.lo == b.lo && joined.hi == b.hi)
+                    continue;
+                if (++updates[target] > kWidenAfter) {
+                    if (joined.lo < b.lo)
+                        joined.lo = 0;
+                    if (joined.hi > b.hi)
+                        joined.hi = kUnboundedDepth;
+                }
+            }
+            b = joined;
+            if (!queued[target]) {
+                worklist.push_back(target);
+                queued[target] = true;
+            }
+        }
+    }
+    return bounds;
+}
+
+int maxStackDepth(const Graph &graph, const std::vector<DepthInterval> &bounds) {
+    int maxDepth = 0;
+    for (size_t i = 0; i < graph.size(); ++i) {
+        if (!bounds[i].reachable())
+            continue;
+        // Within a node the stack never gets deeper than on entry or on exit.
+        int hi = std::max(bounds[i].hi, nodeExit(graph.getTransitions(i), bounds[i]).hi);
+        maxDepth = std::max(maxDepth, hi);
+    }
+    return maxDepth;
+}
@@ -1,38 +1,210 @@
 #include "StackVM.h"
 #include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Initial capacity of a stack created without a size hint.
+static const int kInitialCapacity = 16;
+
+// Values a guarded stack can hold, and the least memory committed at a time (commits double
+// with the committed size, so a stack growing to n bytes takes O(log n) faults).
+static const size_t kGuardedStackValues = size_t(1) << 28;
+static const size_t kGuardedCommitBytes = 256 * 1024;
+
+// Guarded stacks alive at the same time.
+static const int kMaxGuardedStacks = 1024;
+
+// The reservation of a guarded stack: [base, limit) holds the values and is readable and
+// writable up to committed; the page at limit is never committed. base is published last, so
+// the fault handler sees either a free slot or a complete region.
+struct GuardedRegion {
+    std::atomic<bool> inUse{false};
+    std::atomic<char*> base{nullptr};
+    char *limit = nullptr;
+    std::atomic<char*> committed{nullptr};
+};
+
+static GuardedRegion guardedRegions[kMaxGuardedStacks];
+static size_t pageSize;
+static struct sigaction previousSegvAction;
+static std::once_flag guardHandlerOnce;
+
+// Helper: report a stack overflow and abort (async-signal-safe).
+static void guardedStackOverflow() {
+    static const char message[] = "Error: stack overflow\n";
+    if (write(STDERR_FILENO, message, sizeof(message) - 1) < 0) {
+        // Nothing more to do; we are aborting anyway.
+    }
+    std::abort();
+}
+
+// SIGSEGV handler: commit more of the guarded stack the fault hit, or abort on its guard page.
+// Faults outside every guarded stack go to the handler that was installed before.
+static void growGuardedStack(int sig, siginfo_t *info, void *ucontext) {
+    char *address = static_cast<char*>(info->si_addr);
+    for (GuardedRegion &region : guardedRegions) {
+        char *base = region.base.load(std::memory_order_acquire);
+        if (!base || address < base || address >= region.limit + pageSize)
+            continue;
+        if (address >= region.limit)
+            guardedStackOverflow();
+        char *committed = region.committed.load(std::memory_order_relaxed);
+        if (address < committed)
+            return;
+        size_t step = std::max<size_t>(kGuardedCommitBytes, committed - base);
+        char *end = committed;
+        while (end <= address)
+            end = end + std::min<size_t>(step, region.limit - end);
+        if (mprotect(committed, end - committed, PROT_READ | PROT_WRITE) != 0)
+            guardedStackOverflow();
+        region.committed.store(end, std::memory_order_relaxed);
+        return;
+    }
+    if (previousSegvAction.sa_flags & SA_SIGINFO) {
+        previousSegvAction.sa_sigaction(sig, info, ucontext);
+    } else if (previousSegvAction.sa_handler != SIG_DFL && previousSegvAction.sa_handler != SIG_IGN) {
+        previousSegvAction.sa_handler(sig);
+    } else {
+        // Returning re-executes the faulting instruction under the default action.
+        sigaction(SIGSEGV, &previousSegvAction, nullptr);
+    }
+}
+
+// Create a guarded stack.
+Stack* createGuardedStack() {
+    std::call_once(guardHandlerOnce, []() {
+        pageSize = sysconf(_SC_PAGESIZE);
+        struct sigaction action;
+        std::memset(&action, 0, sizeof(action));
+        action.sa_sigaction = growGuardedStack;
+        action.sa_flags = SA_SIGINFO | SA_NODEFER;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &previousSegvAction);
+    });
+
+    GuardedRegion *region = nullptr;
+    for (GuardedRegion &slot : guardedRegions) {
+        bool expected = false;
+        if (slot.inUse.compare_exchange_strong(expected, true)) {
+            region = &slot;
+            break;
+        }
+    }
+    if (!region)
+        return nullptr;
+
+    size_t bytes = kGuardedStackValues * sizeof(int);
+    void *mapping = mmap(nullptr, bytes + pageSize, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED) {
+        region->inUse.store(false);
+        return nullptr;
+    }
+    char *base = static_cast<char*>(mapping);
+    if (mprotect(base, kGuardedCommitBytes, PROT_READ | PROT_WRITE) != 0) {
+        munmap(mapping, bytes + pageSize);
+        region->inUse.store(false);
+        return nullptr;
+    }
+    region->limit = base + bytes;
+    region->committed.store(base + kGuardedCommitBytes, std::memory_order_relaxed);
+    region->base.store(base, std::memory_order_release);
+
+    Stack *stack = new Stack();
+    stack->data = reinterpret_cast<int*>(base);
+    stack->size = 0;
+    stack->capacity = kGuardedStackValues;
+    stack->guarded = 1;
+    return stack;
+}
+
+// Helper: unmap a guarded stack's reservation and free its region.
+static void releaseGuardedStack(Stack *stack) {
+    char *base = reinterpret_cast<char*>(stack->data);
+    for (GuardedRegion &region : guardedRegions) {
+        if (region.base.load(std::memory_order_relaxed) != base)
+            continue;
+        region.base.store(nullptr, std::memory_order_release);
+        munmap(base, region.limit - base + pageSize);
+        region.inUse.store(false);
+        return;
+    }
+}
 
 // Create a new Stack.
 Stack* createStack() {
-    return new Stack();
+    return createStackWithCapacity(kInitialCapacity);
+}
+
+// Create a new Stack with the given capacity.
+Stack* createStackWithCapacity(int capacity) {
+    Stack *stack = new Stack();
+    stack->capacity = std::max(capacity, 1);
+    stack->data = static_cast<int*>(std::malloc(sizeof(int) * stack->capacity));
+    stack->size = 0;
+    return stack;
 }
 
 // Destroy the Stack.
 void destroyStack(Stack* stack) {
     if (stack) {
+        if (stack->guarded)
+            releaseGuardedStack(stack);
+        else
+            std::free(stack->data);
         delete stack;
     }
 }
 
-// Push a value onto the stack.
+// Push a value onto the stack, doubling its capacity when it is full.
 void stackPush(Stack* stack, int value) {
     if (!stack) return;
-    stack->data.push_back(value);
+    if (stack->size == stack->capacity) {
+        if (stack->guarded)
+            guardedStackOverflow();
+        int capacity = stack->capacity * 2;
+        int *data = static_cast<int*>(std::realloc(stack->data, sizeof(int) * capacity));
+        if (!data)
+            std::abort();
+        stack->data = data;
+        stack->capacity = capacity;
+    }
+    stack->data[stack->size++] = value;
+}
+
+// Replace the contents of the stack.
+void stackLoad(Stack* stack, const int *values, int count) {
+    if (!stack) return;
+    if (count > stack->capacity) {
+        if (stack->guarded)
+            guardedStackOverflow();
+        int *data = static_cast<int*>(std::realloc(stack->data, sizeof(int) * count));
+        if (!data)
+            std::abort();
+        stack->data = data;
+        stack->capacity = count;
+    }
+    std::memcpy(stack->data, values, sizeof(int) * count);
+    stack->size = count;
 }
 
 // Pop a value from the stack. If empty, returns 0.
 int stackPop(Stack* stack) {
-    if (!stack || stack->data.empty())
+    if (!stack || stack->size == 0)
         return 0;
-    int value = stack->data.back();
-    stack->data.pop_back();
-    return value;
+    return stack->data[--stack->size];
 }
 
 // Roll the top 'depth' values upward by 'rolls' positions.
 // This rotates the top 'depth' items in the stack. If depth is invalid, do nothing.
 void stackRoll(Stack* stack, int rolls, int depth) {
     if (!stack) return;
-    int size = stack->data.size();
+    int size = stack->size;
     if (depth <= 0 || depth > size)
         return;
     // Normalize the number of rolls.
@@ -42,7 +214,8 @@ void stackRoll(Stack* stack, int rolls, int depth) {
     if (rolls == 0)
         return;
     // Identify the portion to roll.
-    auto start = stack->data.end() - depth;
+    int *end = stack->data + size;
+    int *start = end - depth;
     // Perform the rotation.
-    std::rotate(start, stack->data.end() - rolls, stack->data.end());
+    std::rotate(start, end - rolls, end);
 }
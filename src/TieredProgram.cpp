@@ -0,0 +1,171 @@
+#include "TieredProgram.h"
+#include "IRBuilder.h"
+#include "JITProgram.h"
+#include "ObjectEmitter.h"
+#include "PartialEval.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include <algorithm>
+#include <climits>
+
+using namespace llvm;
+
+// Regions are kept small so that the first hot region of a run is compiled quickly.
+static const int kTierRegionNodes = 256;
+
+TieredProgram::~TieredProgram() {
+    if (compiler.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueReady.notify_all();
+        compiler.join();
+    }
+}
+
+std::unique_ptr<TieredProgram> TieredProgram::loadFile(const std::string &inputFile,
+                                                       const CompileOptions &options,
+                                                       uint64_t hotThreshold) {
+    // The interpreter tier does not record trace events, so a trace would miss part of the run.
+    if (options.trace) {
+        reportError("--tiered cannot be combined with --trace");
+        return nullptr;
+    }
+    std::unique_ptr<TieredProgram> program(new TieredProgram());
+    if (!loadProgramGraph(inputFile, options, program->graph))
+        return nullptr;
+    const Graph &graph = program->graph;
+    program->hotThreshold = hotThreshold > 0 ? hotThreshold : 1;
+    if (graph.empty())
+        return program;
+
+    initializeHostTarget();
+    program->jit = createProgramJIT();
+    if (!program->jit)
+        return nullptr;
+    program->nodeRegion = partitionGraph(graph, kTierRegionNodes);
+    program->numRegions = *std::max_element(program->nodeRegion.begin(), program->nodeRegion.end()) + 1;
+    program->regions.reset(new Region[program->numRegions]);
+
+    // Analyze the graph up front: the interpreter must prepare the stack the way compiled
+    // regions expect it.
+    program->context = std::make_unique<orc::ThreadSafeContext>(std::make_unique<LLVMContext>());
+    program->irgen = std::make_unique<IRGenerator>(*program->context->getContext());
+    program->irgen->setGuardedStack(options.guardedStack);
+    program->irgen->setFuel(options.fuel);
+    program->irgen->prepareRegions(graph);
+    program->fuel = std::min<uint64_t>(options.fuel, LLONG_MAX);   // As in IRGenerator::setFuel.
+    if (program->fuel > 0)
+        program->backEdges = findBackEdges(graph);
+    program->guardedStack = program->irgen->usesGuardedStack();
+    program->stackCapacity = program->irgen->stackCapacity();
+    program->compiler = std::thread(&TieredProgram::compileRegions, program.get());
+    return program;
+}
+
+int TieredProgram::run(piet_ctx *ctx) {
+    Stack *stack = guardedStack ? pietPrepareGuardedStack(ctx) : pietPrepareStack(ctx, stackCapacity);
+    ctx->fuel = fuel;
+    int node = graph.empty() ? -1 : 0;
+    while (node >= 0) {
+        Region &region = regions[nodeRegion[node]];
+        if (RegionFn code = region.code.load(std::memory_order_acquire)) {
+            node = code(stack, ctx, node);
+            if (node == kRegionOutOfFuel)
+                return PIET_OUT_OF_FUEL;
+            continue;
+        }
+        uint64_t executed = region.executed.load(std::memory_order_relaxed) + 1;
+        region.executed.store(executed, std::memory_order_relaxed);
+        if (executed >= hotThreshold && !region.queued.load(std::memory_order_relaxed) &&
+            !region.queued.exchange(true))
+            requestCompile(nodeRegion[node]);
+        int taken = interpret(stack, ctx, node);
+        if (taken < 0)
+            break;
+        // Back edges take fuel, as in generated code.
+        if (fuel > 0 && backEdges[graph.getNode(node).firstEdge + taken] && --ctx->fuel < 0)
+            return PIET_OUT_OF_FUEL;
+        node = graph.getTransitions(node)[taken].targetNode;
+    }
+    return 0;
+}
+
+int TieredProgram::interpret(Stack *stack, piet_ctx *ctx, int node) const {
+    EdgeRange transitions = graph.getTransitions(node);
+    if (transitions.empty())
+        return -1;
+    if (transitions.size() > 1) {
+        // Choose the transition with the popped value, as the generated switch does.
+        unsigned choice = static_cast<unsigned>(stackPop(stack));
+        return choice % transitions.size();
+    }
+    Command command = transitions[0].command;
+    if (!executeStackCommand(stack, command, graph.getNode(node).blockSize)) {
+        switch (command) {
+            case Command::InputNum:
+                pietInputNum(ctx);
+                break;
+            case Command::InputChar:
+                pietInputChar(ctx);
+                break;
+            case Command::OutputNum:
+                pietOutputNum(ctx, stackPop(stack));
+                break;
+            case Command::OutputChar:
+                pietOutputChar(ctx, stackPop(stack));
+                break;
+            default:
+                break;
+        }
+    }
+    return 0;
+}
+
+TieredProgram::Stats TieredProgram::stats() const {
+    Stats result;
+    result.regions = numRegions;
+    result.compiledRegions = compiled.load();
+    for (size_t r = 0; r < numRegions; ++r)
+        result.interpretedNodes += regions[r].executed.load(std::memory_order_relaxed);
+    return result;
+}
+
+void TieredProgram::requestCompile(int region) {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        queue.push_back(region);
+    }
+    queueReady.notify_one();
+}
+
+void TieredProgram::compileRegions() {
+    while (true) {
+        int region;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueReady.wait(lock, [&]() { return stopping || !queue.empty(); });
+            if (stopping)
+                return;
+            region = queue.front();
+            queue.pop_front();
+        }
+
+        // A region that fails to compile keeps running in the interpreter.
+        std::string name = "piet_region" + std::to_string(region);
+        std::unique_ptr<Module> module(irgen->generateRegion(graph, nodeRegion, region, name));
+        if (Error error = jit->addIRModule(orc::ThreadSafeModule(std::move(module), *context))) {
+            reportError(toString(std::move(error)));
+            continue;
+        }
+        Expected<JITEvaluatedSymbol> symbol = jit->lookup(name);
+        if (!symbol) {
+            reportError(toString(symbol.takeError()));
+            continue;
+        }
+        regions[region].code.store(jitTargetAddressToFunction<RegionFn>(symbol->getAddress()),
+                                   std::memory_order_release);
+        ++compiled;
+    }
+}
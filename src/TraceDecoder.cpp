@@ -0,0 +1,147 @@
+// pietric-trace: decode a trace file recorded by a program compiled with --trace, replaying it
+// against the execution graph of the program's source to print the path it took through the
+// codel grid.
+#include "Parser.h"
+#include "Graph.h"
+#include "PietTrace.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+static const char *colorName(PietColor color) {
+    static const char *names[] = {
+        "LightRed", "LightYellow", "LightGreen", "LightCyan", "LightBlue", "LightMagenta",
+        "Red", "Yellow", "Green", "Cyan", "Blue", "Magenta",
+        "DarkRed", "DarkYellow", "DarkGreen", "DarkCyan", "DarkBlue", "DarkMagenta",
+        "White", "Black", "Undefined"
+    };
+    return names[static_cast<int>(color)];
+}
+
+static const char *commandName(unsigned command) {
+    static const char *names[] = {
+        "None", "Push", "Pop", "Add", "Subtract", "Multiply", "Divide", "Modulo", "Not",
+        "Greater", "Pointer", "Switch", "Duplicate", "Roll", "InputNum", "InputChar",
+        "OutputNum", "OutputChar"
+    };
+    return command < sizeof(names) / sizeof(names[0]) ? names[command] : "?";
+}
+
+static const char *dpName(Direction dp) {
+    static const char *names[] = { "Right", "Down", "Left", "Up" };
+    return names[static_cast<int>(dp)];
+}
+
+static const char *ccName(CodelChooser cc) {
+    return cc == CodelChooser::Left ? "Left" : "Right";
+}
+
+static void printUsage() {
+    std::cerr << "Usage: pietric-trace [--limit N] <program> <trace_file>\n"
+              << "Prints the states executed by a program compiled with --trace, one per line:\n"
+              << "  thread step node block (row,col) color dp cc command top\n";
+}
+
+int main(int argc, char **argv) {
+    std::string programFile, traceFile;
+    long long limit = -1;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--limit" && i + 1 < argc) {
+            limit = std::atoll(argv[++i]);
+        } else if (!arg.empty() && arg[0] == '-') {
+            std::cerr << "Unknown option: " << arg << "\n";
+            printUsage();
+            return 1;
+        } else if (programFile.empty()) {
+            programFile = arg;
+        } else if (traceFile.empty()) {
+            traceFile = arg;
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+    if (traceFile.empty()) {
+        printUsage();
+        return 1;
+    }
+
+    // Rebuild the graph exactly as --trace compiled it (without minimization).
+    Parser parser;
+    if (!parser.parseFile(programFile)) {
+        std::cerr << "Failed to parse the input file.\n";
+        return 1;
+    }
+    if (parser.getGrid().empty()) {
+        std::cerr << "Error: empty input.\n";
+        return 1;
+    }
+    Graph graph;
+    graph.buildGraph(parser.getGrid());
+
+    auto buffer = llvm::MemoryBuffer::getFile(traceFile, /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/false);
+    if (!buffer) {
+        std::cerr << "Error: Cannot open file " << traceFile << "\n";
+        return 1;
+    }
+    const char *data = (*buffer)->getBufferStart();
+    size_t size = (*buffer)->getBufferSize();
+    TraceFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    if (size >= sizeof(header))
+        std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, kTraceFileMagic, sizeof(header.magic)) != 0 ||
+        header.version != kTraceFileVersion) {
+        std::cerr << "Error: " << traceFile << " is not a version " << kTraceFileVersion
+                  << " trace file\n";
+        return 1;
+    }
+    if (header.numNodes != graph.size()) {
+        std::cerr << "Error: the trace was recorded from a graph of " << header.numNodes
+                  << " nodes, but " << programFile << " has " << graph.size() << "\n";
+        return 1;
+    }
+
+    // Next step number of every thread. Thread ids come from the file, so they are keys rather
+    // than indices.
+    std::map<uint32_t, long long> steps;
+    long long printed = 0;
+    size_t offset = sizeof(header);
+    while (offset < size && (limit < 0 || printed < limit)) {
+        TraceChunkHeader chunk;
+        if (size - offset < sizeof(chunk)) {
+            std::cerr << "Error: truncated chunk at offset " << offset << "\n";
+            return 1;
+        }
+        std::memcpy(&chunk, data + offset, sizeof(chunk));
+        offset += sizeof(chunk);
+        if ((size - offset) / sizeof(TraceRecord) < chunk.count) {
+            std::cerr << "Error: truncated chunk at offset " << offset << "\n";
+            return 1;
+        }
+        long long &step = steps[chunk.thread];
+        for (uint32_t i = 0; i < chunk.count && (limit < 0 || printed < limit); ++i, ++printed) {
+            TraceRecord record;
+            std::memcpy(&record, data + offset + i * sizeof(TraceRecord), sizeof(record));
+            if (record.node >= graph.size()) {
+                std::cerr << "Error: invalid node " << record.node << " in the trace\n";
+                return 1;
+            }
+            const GraphNode &node = graph.getNode(record.node);
+            std::pair<int,int> codel = graph.blockOrigin(node.blockId);
+            std::cout << chunk.thread << " " << step++ << " node " << record.node
+                      << " block " << node.blockId << " (" << codel.first << "," << codel.second
+                      << ") " << colorName(graph.blockColor(node.blockId)) << " "
+                      << dpName(node.dp) << " " << ccName(node.cc) << " "
+                      << commandName(record.command) << " " << record.top << "\n";
+        }
+        offset += chunk.count * sizeof(TraceRecord);
+    }
+    return 0;
+}
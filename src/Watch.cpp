@@ -0,0 +1,116 @@
+#include "Watch.h"
+#include "JITProgram.h"
+#include "Parser.h"
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// How often the program file is checked for changes.
+static const std::chrono::milliseconds kPollInterval(200);
+
+// Helper: report how a finished run ended.
+static void reportExit(int status) {
+    if (WIFSIGNALED(status))
+        consoleErr() << "[watch] program killed by signal " << WTERMSIG(status) << "\n";
+    else if (WIFEXITED(status) && WEXITSTATUS(status) == PIET_OUT_OF_FUEL)
+        consoleErr() << "[watch] program ran out of fuel\n";
+    else if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+        consoleErr() << "[watch] program exited with status " << WEXITSTATUS(status) << "\n";
+    else
+        consoleErr() << "[watch] program finished\n";
+}
+
+// Helper: run the program in a child process. Returns its pid, or -1 if it cannot be started.
+static pid_t startRun(piet_run_fn run, const std::string &inputFile) {
+    consoleOut().flush();
+    std::fflush(stdout);
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+    if (!inputFile.empty()) {
+        int fd = open(inputFile.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::perror(inputFile.c_str());
+            _exit(1);
+        }
+        dup2(fd, STDIN_FILENO);
+        close(fd);
+    }
+    piet_ctx *ctx = pietCreateStdioContext();
+    int status = run(ctx);
+    pietDestroyContext(ctx);
+    std::fflush(stdout);
+    _exit(status);
+}
+
+// Helper: stop a run that is still going.
+static void stopRun(pid_t pid) {
+    int status;
+    if (waitpid(pid, &status, WNOHANG) == 0) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        consoleErr() << "[watch] stopped the run of the previous version\n";
+    } else {
+        reportExit(status);
+    }
+}
+
+int runWatch(const std::string &programFile, const std::string &inputFile,
+             const CompileOptions &options) {
+    std::unique_ptr<IncrementalProgram> program = IncrementalProgram::create(options);
+    if (!program)
+        return 1;
+
+    fs::file_time_type lastWrite;
+    uintmax_t lastSize = 0;
+    bool seen = false;
+    pid_t child = -1;
+    consoleErr() << "[watch] watching " << programFile << "\n";
+    while (true) {
+        // Report a run that finished on its own.
+        int status;
+        if (child > 0 && waitpid(child, &status, WNOHANG) == child) {
+            reportExit(status);
+            child = -1;
+        }
+
+        std::error_code ec;
+        fs::file_time_type write = fs::last_write_time(programFile, ec);
+        uintmax_t size = ec ? 0 : fs::file_size(programFile, ec);
+        if (ec || (seen && write == lastWrite && size == lastSize)) {
+            std::this_thread::sleep_for(kPollInterval);
+            continue;
+        }
+        seen = true;
+        lastWrite = write;
+        lastSize = size;
+
+        // A file caught in the middle of being written may not parse; the next write fixes it.
+        Parser parser;
+        if (!parser.parseFile(programFile) || parser.getGrid().empty())
+            continue;
+        auto start = std::chrono::steady_clock::now();
+        if (!program->update(parser.getGrid()))
+            continue;
+        auto elapsed = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+        const IncrementalProgram::UpdateStats &stats = program->lastUpdate();
+        std::fprintf(stderr, "[watch] rebuilt in %.1f ms (explored %zu of %zu states, "
+                     "compiled %zu of %zu regions)\n", elapsed, stats.exploredStates, stats.states,
+                     stats.compiledRegions, stats.regions);
+
+        if (child > 0)
+            stopRun(child);
+        child = startRun(program->entry(), inputFile);
+        if (child < 0)
+            std::perror("fork");
+    }
+}
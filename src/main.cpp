@@ -1,51 +1,268 @@
-#include "Parser.h"
-#include "Graph.h"
-#include "IRBuilder.h"
-#include "llvm/Support/raw_ostream.h"
+#include "Driver.h"
+#include "Batch.h"
+#include "Daemon.h"
+#include "DaemonProtocol.h"
+#include "JITProgram.h"
+#include "TieredProgram.h"
+#include "Watch.h"
 #include "llvm/IR/LLVMContext.h"
-#include "llvm/IR/Module.h"
-#include "llvm/Support/FileSystem.h"
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <functional>
 #include <iostream>
-#include <fstream>
+#include <string>
 
-int main(int argc, char **argv) {
-    if (argc < 2) {
-        std::cerr << "Usage: pietc <input_file>\n";
-        return 1;
+static void printUsage() {
+    consoleErr() << "Usage: pietc [options] <input_file|graph_file>\n"
+              << "       pietc [options] --batch <list_file|directory> [-j N] [--out-dir <dir>]\n"
+              << "       pietc [options] --run <program> [--inputs <list_file|directory>]\n"
+              << "             [-j N] [--out-dir <dir>]\n"
+              << "       pietc [options] --watch <program> [--input <file>]\n"
+              << "       pietc --daemon [--socket <path>] [-j N]\n"
+              << "Options:\n"
+              << "  -o <file>          Write the output to <file> (default: output.ll or output.o)\n"
+              << "  --emit=<kind>      Output kind: ll (LLVM IR, default), obj (object file)\n"
+              << "                     graph (execution graph file, reusable as an input)\n"
+              << "                     or codels (packed codel file, reusable as an input)\n"
+              << "  --codegen-threads <N>\n"
+              << "                     Split the object code into N parts generated in parallel\n"
+              << "                     (output.o becomes output.0.o ... output.<N-1>.o)\n"
+              << "  --partition-threshold <N>\n"
+              << "                     Split graphs of at least N nodes into one function per\n"
+              << "                     group of strongly connected components (default: 4096,\n"
+              << "                     0: always, -1: never)\n"
+              << "  --no-minimize      Do not merge equivalent states of the execution graph\n"
+              << "  --guarded-stack    Run programs of unbounded stack depth on a guarded stack\n"
+              << "                     that grows on page faults (pushes are never checked)\n"
+              << "  --eval-steps <N>   Run up to N steps of the program before its first input at\n"
+              << "                     compile time (default: 1000000, 0: none)\n"
+              << "  --fuel <N>         Stop runs after N loop iterations (back edges of the\n"
+              << "                     execution graph) with exit status 3 (default: 0, unlimited)\n"
+              << "  --trace            Record every executed state to a trace file at run time\n"
+              << "                     (link with PietTrace.cpp; decode with pietric-trace)\n"
+              << "  --cache-dir <dir>  Reuse compiled artifacts from the cache in <dir>\n"
+              << "                     (default: $PIETRIC_CACHE_DIR, if set)\n"
+              << "  --no-cache         Disable the compile cache\n"
+              << "  --batch <source>   Compile every file in a directory, or every path listed\n"
+              << "                     in a file (one per line)\n"
+              << "  --run <program>    JIT-compile a program and run it on stdin/stdout or, with\n"
+              << "                     --inputs, once per input file (output: <stem>.out)\n"
+              << "  --inputs <source>  Input files of --run: a directory, or a file listing paths\n"
+              << "  --tiered           Start --run in a graph interpreter and JIT-compile regions\n"
+              << "                     in the background once they get hot\n"
+              << "  --tier-threshold <N>\n"
+              << "                     Nodes a region executes before it is compiled (default:\n"
+              << "                     10000)\n"
+              << "  --watch <program>  Recompile a program incrementally whenever it changes and\n"
+              << "                     run each version (on stdin, or on the --input file)\n"
+              << "  --input <file>     Input of every --watch run\n"
+              << "  --daemon           Serve the command lines of pietric-client, keeping LLVM and\n"
+              << "                     parsed programs in memory between them\n"
+              << "  --socket <path>    Socket of --daemon, in a directory only you can write to\n"
+              << "                     (default: $PIETRIC_DAEMON_SOCKET, $XDG_RUNTIME_DIR/\n"
+              << "                     pietric.sock, or /tmp/pietric-<uid>/daemon.sock)\n"
+              << "  -j <N>             Number of batch, run or daemon worker threads (default: all\n"
+              << "                     cores)\n"
+              << "  --out-dir <dir>    Directory of batch and run outputs (default: next to each\n"
+              << "                     input)\n";
+}
+
+// Helper: parse the non-negative decimal count given to option. Returns false, after reporting
+// why, for anything else (a sign, other characters, or a value beyond 64 bits).
+static bool parseCount(const std::string &option, const std::string &text, uint64_t &value) {
+    errno = 0;
+    char *end = nullptr;
+    unsigned long long parsed = std::strtoull(text.c_str(), &end, 10);
+    if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0])) || *end != '\0' ||
+        errno == ERANGE) {
+        consoleErr() << "Error: " << option << " expects a non-negative integer, not '" << text
+                  << "'\n";
+        return false;
     }
-    std::string inputFilename = argv[1];
+    value = parsed;
+    return true;
+}
 
-    // 1. Parse the Piet program (text or image).
-    Parser parser;
-    if (!parser.parseFile(inputFilename)) {
-        std::cerr << "Failed to parse the input file.\n";
-        return 1;
+// Run one command line, in this process or in the daemon.
+static int runCommand(const CommandLine &command) {
+    const std::vector<std::string> &args = command.args;
+    CompileOptions options;
+    options.cacheDir = command.cacheDir;
+    options.programCache = command.programCache;
+    std::string inputFilename;
+    std::string outputFilename;
+    std::string batchSource;
+    std::string outDir;
+    std::string runProgram;
+    std::string inputsSource;
+    std::string watchProgram;
+    std::string watchInput;
+    int jobs = 0;
+    bool tiered = false;
+    uint64_t tierThreshold = 10000;
+    bool daemon = false;
+    std::string socketPath;
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string &arg = args[i];
+        if (arg == "-o" && i + 1 < args.size()) {
+            outputFilename = args[++i];
+        } else if (arg == "--emit=ll") {
+            options.emit = EmitKind::LLVMIR;
+        } else if (arg == "--emit=obj") {
+            options.emit = EmitKind::Object;
+        } else if (arg == "--emit=graph") {
+            options.emit = EmitKind::Graph;
+        } else if (arg == "--emit=codels") {
+            options.emit = EmitKind::Codels;
+        } else if (arg == "--codegen-threads" && i + 1 < args.size()) {
+            options.codegenThreads = std::atoi(args[++i].c_str());
+        } else if (arg == "--partition-threshold" && i + 1 < args.size()) {
+            options.partitionThreshold = std::atoi(args[++i].c_str());
+        } else if (arg == "--no-minimize") {
+            options.minimize = false;
+        } else if (arg == "--guarded-stack") {
+            options.guardedStack = true;
+        } else if (arg == "--eval-steps" && i + 1 < args.size()) {
+            if (!parseCount(arg, args[++i], options.evalSteps))
+                return 1;
+        } else if (arg == "--fuel" && i + 1 < args.size()) {
+            if (!parseCount(arg, args[++i], options.fuel))
+                return 1;
+        } else if (arg == "--trace") {
+            options.trace = true;
+        } else if (arg == "--cache-dir" && i + 1 < args.size()) {
+            options.cacheDir = args[++i];
+        } else if (arg == "--no-cache") {
+            options.cacheDir.clear();
+        } else if (arg == "--batch" && i + 1 < args.size()) {
+            batchSource = args[++i];
+        } else if (arg == "--run" && i + 1 < args.size()) {
+            runProgram = args[++i];
+        } else if (arg == "--inputs" && i + 1 < args.size()) {
+            inputsSource = args[++i];
+        } else if (arg == "--tiered") {
+            tiered = true;
+        } else if (arg == "--tier-threshold" && i + 1 < args.size()) {
+            if (!parseCount(arg, args[++i], tierThreshold))
+                return 1;
+        } else if (arg == "--watch" && i + 1 < args.size()) {
+            watchProgram = args[++i];
+        } else if (arg == "--input" && i + 1 < args.size()) {
+            watchInput = args[++i];
+        } else if (arg == "--daemon") {
+            daemon = true;
+        } else if (arg == "--socket" && i + 1 < args.size()) {
+            socketPath = args[++i];
+        } else if (arg == "-j" && i + 1 < args.size()) {
+            jobs = std::atoi(args[++i].c_str());
+        } else if (arg.size() > 2 && arg.compare(0, 2, "-j") == 0) {
+            jobs = std::atoi(arg.c_str() + 2);
+        } else if (arg == "--out-dir" && i + 1 < args.size()) {
+            outDir = args[++i];
+        } else if (!arg.empty() && arg[0] == '-') {
+            consoleErr() << "Unknown option: " << arg << "\n";
+            printUsage();
+            return 1;
+        } else if (inputFilename.empty()) {
+            inputFilename = arg;
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+    if (daemon) {
+        if (command.inDaemon || !inputFilename.empty() || !batchSource.empty() ||
+            !runProgram.empty() || !watchProgram.empty()) {
+            printUsage();
+            return 1;
+        }
+        return runDaemon(socketPath.empty() ? daemonSocketPath() : socketPath, jobs, runCommand);
     }
-    auto grid = parser.getGrid();
-    if (grid.empty()) {
-        std::cerr << "Error: empty input.\n";
+    if (!watchProgram.empty()) {
+        if (!inputFilename.empty() || !batchSource.empty() || !runProgram.empty()) {
+            printUsage();
+            return 1;
+        }
+        if (command.inDaemon) {
+            consoleErr() << "Error: --watch cannot run in the daemon\n";
+            return 1;
+        }
+        return runWatch(watchProgram, watchInput, options);
+    }
+    if (!runProgram.empty()) {
+        if (!inputFilename.empty() || !batchSource.empty()) {
+            printUsage();
+            return 1;
+        }
+        // Traces are per process and tiered runs compile on a thread of their own; neither
+        // survives in the child process a daemon runs the program in.
+        if (command.inDaemon && (options.trace || tiered)) {
+            consoleErr() << "Error: --run with " << (tiered ? "--tiered" : "--trace")
+                      << " cannot run in the daemon\n";
+            return 1;
+        }
+        std::unique_ptr<JITProgram> program;
+        std::unique_ptr<TieredProgram> tieredProgram;
+        std::function<int(piet_ctx*)> run;
+        if (tiered) {
+            tieredProgram = TieredProgram::loadFile(runProgram, options, tierThreshold);
+            if (tieredProgram)
+                run = [&](piet_ctx *ctx) { return tieredProgram->run(ctx); };
+        } else {
+            program = JITProgram::compileFile(runProgram, options);
+            if (program)
+                run = program->entry();
+        }
+        if (!run)
+            return 1;
+        std::vector<std::string> inputs;
+        if (!inputsSource.empty() && !collectBatchInputs(inputsSource, inputs))
+            return 1;
+        auto execute = [&]() {
+            if (!inputsSource.empty())
+                return runInputs(run, inputs, outDir, jobs) == 0 ? 0 : 1;
+            piet_ctx *ctx = pietCreateStreamContext(command.in, command.out);
+            int status = run(ctx);
+            pietDestroyContext(ctx);
+            return status;
+        };
+        return command.inDaemon ? runInChild(command, execute) : execute();
+    }
+    if (!batchSource.empty()) {
+        if (!inputFilename.empty()) {
+            printUsage();
+            return 1;
+        }
+        std::vector<std::string> inputs;
+        if (!collectBatchInputs(batchSource, inputs))
+            return 1;
+        return runBatch(inputs, outDir, jobs, options) == 0 ? 0 : 1;
+    }
+    if (inputFilename.empty()) {
+        printUsage();
         return 1;
     }
 
-    // 2. Build the execution graph.
-    Graph graph;
-    graph.buildGraph(grid);
+    if (outputFilename.empty())
+        outputFilename = std::string("output.") + outputExtension(options.emit);
 
-    // 3. Generate LLVM IR.
     llvm::LLVMContext context;
-    IRGenerator irgen(context);
-    llvm::Module *module = irgen.generateModule(graph);
-
-    // 4. Output the LLVM IR to a file.
-    std::error_code EC;
-    llvm::raw_fd_ostream out("output.ll", EC, llvm::sys::fs::OF_Text);
-    if (EC) {
-        std::cerr << "Error opening output file: " << EC.message() << "\n";
+    if (!compileFile(inputFilename, outputFilename, options, context))
         return 1;
-    }
-    module->print(out, nullptr);
-    delete module;
 
-    std::cout << "Compilation successful. LLVM IR written to output.ll\n";
+    consoleOut() << "Compilation successful. Output written to";
+    for (const auto &path : outputPaths(outputFilename, options))
+        consoleOut() << " " << path;
+    consoleOut() << "\n";
     return 0;
 }
+
+int main(int argc, char **argv) {
+    CommandLine command;
+    command.args.assign(argv + 1, argv + argc);
+    if (const char *env = std::getenv("PIETRIC_CACHE_DIR"))
+        command.cacheDir = env;
+    return runCommand(command);
+}
@@ -0,0 +1,60 @@
+// Checks the pixel kernels in use (see PixelKernels.h; PIETRIC_SIMD selects them) against the
+// hex-string color lookup of Utils.h, on random buffers of every length around the vector
+// widths and at unaligned addresses. Exits with 0 if they agree everywhere.
+#include "PixelKernels.h"
+#include "Utils.h"
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+int main() {
+    std::mt19937 random(42);
+    // Mostly valid channel values, so that pixels are often Piet colors.
+    const uint8_t channels[] = { 0x00, 0xC0, 0xFF, 0x00, 0xC0, 0xFF, 0x01, 0x80, 0xBF, 0xFE };
+    auto channel = [&]() { return channels[random() % sizeof(channels)]; };
+    int failures = 0;
+    long checked = 0;
+    for (int round = 0; round < 200; ++round) {
+        for (size_t count = 0; count <= 100; ++count) {
+            size_t shift = random() % 16;   // Byte offset of the first pixel.
+            std::vector<uint8_t> buffer(shift + 3 * count + 1);
+            uint8_t *rgb = buffer.data() + shift;
+            for (size_t i = 0; i < 3 * count; ++i)
+                rgb[i] = channel();
+
+            std::vector<uint8_t> colors(count + 1, 0xAA);
+            classifyPixels(rgb, count, colors.data());
+            for (size_t i = 0; i < count; ++i) {
+                std::string hex = rgbToHex(rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2]);
+                PietColor expected = hexToPietColor(hex);
+                if (colors[i] != static_cast<uint8_t>(expected) && failures++ < 10)
+                    std::cerr << "classifyPixels: pixel " << i << " of " << count << " is " << hex
+                              << ", got color " << int(colors[i]) << ", expected "
+                              << int(expected) << "\n";
+            }
+            if (colors[count] != 0xAA && failures++ < 10)
+                std::cerr << "classifyPixels: wrote past " << count << " pixels\n";
+
+            // A run of one pixel, possibly with one channel of one pixel changed.
+            uint8_t reference[3] = { channel(), channel(), channel() };
+            for (size_t i = 0; i < count; ++i)
+                for (int c = 0; c < 3; ++c)
+                    rgb[3 * i + c] = reference[c];
+            bool expected = true;
+            if (count > 0 && random() % 2) {
+                size_t byte = random() % (3 * count);
+                rgb[byte] ^= 1 + random() % 255;
+                expected = false;
+            }
+            if (pixelsMatch(rgb, count, reference) != expected && failures++ < 10)
+                std::cerr << "pixelsMatch: wrong result for " << count << " pixels (expected "
+                          << expected << ")\n";
+            ++checked;
+        }
+    }
+    std::cout << "pixel kernels (" << pixelKernelName() << "): " << checked << " buffers, "
+              << failures << " mismatches\n";
+    return failures == 0 ? 0 : 1;
+}
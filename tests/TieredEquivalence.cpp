@@ -0,0 +1,160 @@
+// Checks that tiered runs (TieredProgram) behave exactly like JIT-compiled ones (JITProgram) on
+// random execution graphs: same output and status, including where a fuel budget runs out, with
+// and without guarded stacks, whether a run stays in the interpreter, switches tiers midway or
+// runs compiled regions only, and on several threads at once. Exits with 0 if all runs agree.
+#include "Graph.h"
+#include "JITProgram.h"
+#include "TieredProgram.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const char kInput[] = "12 7 300\nhello";
+
+// Helper: write a random graph file of n nodes. Most nodes execute one command and continue with
+// the next node; some jump elsewhere, some branch on the popped value, a few stop. Divide and
+// Modulo are left out, since a division by zero would end the whole test.
+static bool writeRandomGraph(const std::string &path, std::mt19937 &random, uint32_t n) {
+    const Command commands[] = {
+        Command::Push, Command::Push, Command::Push, Command::Push, Command::Pop, Command::Add,
+        Command::Subtract, Command::Multiply, Command::Not, Command::Greater, Command::Duplicate,
+        Command::Duplicate, Command::Roll, Command::InputNum, Command::InputChar,
+        Command::OutputNum, Command::OutputChar, Command::OutputChar,
+    };
+    std::vector<GraphNode> nodes(n);
+    std::vector<GraphEdge> edges;
+    for (uint32_t i = 0; i < n; ++i) {
+        GraphNode &node = nodes[i];
+        node.blockId = i;
+        node.blockSize = 1 + random() % 40;
+        node.firstEdge = edges.size();
+        node.dp = Direction::Right;
+        node.cc = CodelChooser::Left;
+        unsigned kind = random() % 100;
+        if (i + 1 == n || kind < 2) {
+            node.numEdges = 0;
+        } else if (kind < 20) {
+            node.numEdges = 2 + random() % 3;
+            for (int e = 0; e < node.numEdges; ++e) {
+                uint32_t target = random() % n;
+                edges.push_back(GraphEdge{ target, Command::None, {} });
+            }
+        } else {
+            node.numEdges = 1;
+            uint32_t target = random() % 100 < 80 ? i + 1 : random() % n;
+            Command command = commands[random() % (sizeof(commands) / sizeof(commands[0]))];
+            edges.push_back(GraphEdge{ target, command, {} });
+        }
+    }
+
+    GraphFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "PIETGRF", 8);
+    header.version = 1;
+    header.numNodes = n;
+    header.numEdges = edges.size();
+    header.nodesOffset = (sizeof(header) + 15) / 16 * 16;
+    header.edgesOffset = (header.nodesOffset + n * sizeof(GraphNode) + 15) / 16 * 16;
+    std::string data(header.edgesOffset + edges.size() * sizeof(GraphEdge), '\0');
+    std::memcpy(&data[0], &header, sizeof(header));
+    std::memcpy(&data[header.nodesOffset], nodes.data(), n * sizeof(GraphNode));
+    if (!edges.empty())
+        std::memcpy(&data[header.edgesOffset], edges.data(), edges.size() * sizeof(GraphEdge));
+    std::ofstream out(path, std::ios::binary);
+    return static_cast<bool>(out.write(data.data(), data.size()));
+}
+
+// The observable result of one run.
+struct RunResult {
+    int status;
+    std::string output;
+    bool operator==(const RunResult &other) const {
+        return status == other.status && output == other.output;
+    }
+};
+
+// Helper: run a program once on a buffer context holding kInput.
+static RunResult runOnce(const std::function<int(piet_ctx*)> &run) {
+    piet_ctx *ctx = pietCreateContext(kInput, sizeof(kInput) - 1);
+    RunResult result;
+    result.status = run(ctx);
+    result.output.assign(ctx->output, ctx->outputSize);
+    pietDestroyContext(ctx);
+    return result;
+}
+
+int main() {
+    const std::string path = "tiered-equivalence.pgraph";
+    const uint64_t thresholds[] = { 1, 100, std::numeric_limits<uint64_t>::max() };
+    const int kThreads = 4;
+    std::mt19937 random(7);
+    int failures = 0, runs = 0;
+    for (int seed = 0; seed < 24; ++seed) {
+        if (!writeRandomGraph(path, random, 20 + random() % 300)) {
+            std::cerr << "cannot write " << path << "\n";
+            return 1;
+        }
+        for (bool guarded : { false, true }) {
+            CompileOptions options;
+            options.minimize = false;
+            options.guardedStack = guarded;
+            options.fuel = 1 + random() % 5000;     // Random graphs often loop forever.
+            std::unique_ptr<JITProgram> jit = JITProgram::compileFile(path, options);
+            if (!jit) {
+                std::cerr << "graph " << seed << ": JIT compilation failed\n";
+                return 1;
+            }
+            RunResult expected = runOnce(jit->entry());
+            for (uint64_t threshold : thresholds) {
+                std::unique_ptr<TieredProgram> tiered =
+                    TieredProgram::loadFile(path, options, threshold);
+                if (!tiered) {
+                    std::cerr << "graph " << seed << ": cannot load the tiered program\n";
+                    return 1;
+                }
+                auto run = [&](piet_ctx *ctx) { return tiered->run(ctx); };
+                auto check = [&](const RunResult &result, const char *phase) {
+                    ++runs;
+                    if (result == expected || failures++ >= 10)
+                        return;
+                    std::cerr << "graph " << seed << (guarded ? " (guarded)" : "")
+                              << ", threshold " << threshold << ", " << phase << ": status "
+                              << result.status << " (expected " << expected.status << "), "
+                              << result.output.size() << " output bytes (expected "
+                              << expected.output.size() << ")\n";
+                };
+                // Concurrent runs while regions get hot and compiled in the background.
+                std::vector<RunResult> results(kThreads);
+                std::vector<std::thread> threads;
+                for (int t = 0; t < kThreads; ++t)
+                    threads.emplace_back([&, t]() { results[t] = runOnce(run); });
+                for (auto &thread : threads)
+                    thread.join();
+                for (const RunResult &result : results)
+                    check(result, "concurrent run");
+                // Once the regions queued so far are compiled, a run that uses their native code.
+                auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+                size_t compiled = tiered->stats().compiledRegions, previous;
+                do {
+                    previous = compiled;
+                    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                    compiled = tiered->stats().compiledRegions;
+                } while (threshold == 1 && compiled != previous &&
+                         std::chrono::steady_clock::now() < deadline);
+                check(runOnce(run), "later run");
+            }
+        }
+    }
+    std::remove(path.c_str());
+    std::cout << "tiered equivalence: " << runs << " runs, " << failures << " mismatches\n";
+    return failures == 0 ? 0 : 1;
+}